@@ -0,0 +1,225 @@
+//
+// Created by Homin Su on 2023/6/16.
+//
+
+#ifndef STELLA_BENCH_BENCH_H_
+#define STELLA_BENCH_BENCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "stella/non_copyable.h"
+
+#ifndef STELLA_BENCH_REVISION
+#define STELLA_BENCH_REVISION "unknown"
+#endif
+
+/**
+ * Minimal benchmark harness, every benchmark is a single translation unit including this header
+ * before any stella header, it replaces the stella allocation macros to count allocations, the
+ * global operator new / delete counting as well come from support/allocation.cc.
+ *
+ *   --filter <substr>   run only the cases whose name contains substr
+ *   --min-time <sec>    minimum measured time per case, 0.2 by default
+ *   --json              print one JSON record per case to stdout instead of the table
+ *   --out <file>        append the JSON records to file
+ */
+namespace stella::bench {
+
+inline ::std::atomic<::std::uint64_t> g_alloc_count{0};
+inline ::std::atomic<::std::uint64_t> g_alloc_bytes{0};
+inline ::std::atomic<bool> g_alloc_counting{false};
+
+inline void CountAllocation(::std::size_t size) {
+  if (g_alloc_counting.load(::std::memory_order_relaxed)) {
+    g_alloc_count.fetch_add(1, ::std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, ::std::memory_order_relaxed);
+  }
+}
+
+inline void *CountedMalloc(::std::size_t size) {
+  CountAllocation(size);
+  return ::std::malloc(size);
+}
+
+inline void *CountedRealloc(void *ptr, ::std::size_t new_size) {
+  CountAllocation(new_size);
+  return ::std::realloc(ptr, new_size);
+}
+
+/**
+ * @brief do not let the compiler drop a computed value
+ */
+template<typename T>
+inline void DoNotOptimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const T *sink;
+  sink = &value;
+#endif
+}
+
+class Iteration : NonCopyable {
+ private:
+  using Clock = ::std::chrono::steady_clock;
+
+  Clock::time_point start_;
+  Clock::duration elapsed_{};
+  ::std::uint64_t allocs_ = 0;
+  ::std::uint64_t bytes_ = 0;
+  bool running_ = false;
+
+ public:
+  /**
+   * @brief excludes setup and teardown from the timing and the allocation counts
+   */
+  void Pause();
+  void Resume();
+
+  [[nodiscard]] double Nanoseconds() const { return ::std::chrono::duration<double, ::std::nano>(elapsed_).count(); }
+  [[nodiscard]] ::std::uint64_t Allocations() const { return allocs_; }
+  [[nodiscard]] ::std::uint64_t AllocatedBytes() const { return bytes_; }
+};
+
+inline void Iteration::Pause() {
+  if (!running_) { return; }
+  elapsed_ += Clock::now() - start_;
+  g_alloc_counting.store(false, ::std::memory_order_relaxed);
+  allocs_ += g_alloc_count.exchange(0, ::std::memory_order_relaxed);
+  bytes_ += g_alloc_bytes.exchange(0, ::std::memory_order_relaxed);
+  running_ = false;
+}
+
+inline void Iteration::Resume() {
+  if (running_) { return; }
+  g_alloc_count.store(0, ::std::memory_order_relaxed);
+  g_alloc_bytes.store(0, ::std::memory_order_relaxed);
+  g_alloc_counting.store(true, ::std::memory_order_relaxed);
+  running_ = true;
+  start_ = Clock::now();
+}
+
+class Runner : NonCopyable {
+ private:
+  ::std::string filter_;
+  ::std::string out_;
+  double min_time_ = 0.2;
+  bool json_ = false;
+  bool header_ = false;
+
+ public:
+  Runner(int argc, char *argv[]);
+
+  /**
+   * @brief runs fn(Iteration &) until the minimum time is spent and reports the median run
+   * @param items units of work done by one run, times are reported per item
+   */
+  template<typename Fn>
+  void Run(::std::string_view name, ::std::size_t items, Fn &&fn);
+
+ private:
+  void Report(::std::string_view name, ::std::size_t items, ::std::size_t runs,
+              double median, double min, double allocs, double bytes);
+};
+
+inline Runner::Runner(int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    ::std::string_view arg = argv[i];
+    if (arg == "--filter" && i + 1 < argc) { filter_ = argv[++i]; }
+    else if (arg == "--min-time" && i + 1 < argc) { min_time_ = ::std::atof(argv[++i]); }
+    else if (arg == "--out" && i + 1 < argc) { out_ = argv[++i]; }
+    else if (arg == "--json") { json_ = true; }
+    else {
+      fprintf(stderr, "usage: %s [--filter substr] [--min-time sec] [--json] [--out file]\n", argv[0]);
+      ::std::exit(EXIT_FAILURE);
+    }
+  }
+}
+
+template<typename Fn>
+inline void Runner::Run(::std::string_view name, ::std::size_t items, Fn &&fn) {
+  if (!filter_.empty() && name.find(filter_) == ::std::string_view::npos) { return; }
+
+  // warm up
+  {
+    Iteration it;
+    it.Resume();
+    fn(it);
+    it.Pause();
+  }
+
+  ::std::vector<double> times;
+  double total = 0, allocs = 0, bytes = 0;
+  while (total < min_time_ * 1e9 || times.size() < 3) {
+    Iteration it;
+    it.Resume();
+    fn(it);
+    it.Pause();
+    times.push_back(it.Nanoseconds());
+    total += it.Nanoseconds();
+    allocs += static_cast<double>(it.Allocations());
+    bytes += static_cast<double>(it.AllocatedBytes());
+    if (times.size() >= 1000000) { break; }
+  }
+
+  auto runs = times.size();
+  ::std::nth_element(times.begin(), times.begin() + static_cast<::std::ptrdiff_t>(runs / 2), times.end());
+  auto median = times[runs / 2];
+  auto min = *::std::min_element(times.begin(), times.end());
+  auto per = static_cast<double>(items == 0 ? 1 : items);
+  Report(name, items, runs, median / per, min / per,
+         allocs / static_cast<double>(runs), bytes / static_cast<double>(runs));
+}
+
+inline void Runner::Report(::std::string_view name, ::std::size_t items, ::std::size_t runs,
+                           double median, double min, double allocs, double bytes) {
+  char record[512];
+  snprintf(record, sizeof(record),
+           R"({"name":"%.*s","revision":"%s","items":%zu,"runs":%zu,)"
+           R"("ns_per_item":%.3f,"ns_per_item_min":%.3f,"allocs_per_run":%.1f,"bytes_per_run":%.1f})",
+           static_cast<int>(name.size()), name.data(), STELLA_BENCH_REVISION, items, runs,
+           median, min, allocs, bytes);
+
+  if (json_) {
+    puts(record);
+  } else {
+    if (!header_) {
+      printf("%-48s %10s %14s %14s %14s\n", "case", "runs", "ns/item", "allocs/run", "bytes/run");
+      header_ = true;
+    }
+    printf("%-48.*s %10zu %14.2f %14.1f %14.1f\n",
+           static_cast<int>(name.size()), name.data(), runs, median, allocs, bytes);
+  }
+  fflush(stdout);
+
+  if (!out_.empty()) {
+    if (FILE *fp = fopen(out_.c_str(), "a")) {
+      fprintf(fp, "%s\n", record);
+      fclose(fp);
+    }
+  }
+}
+
+} // namespace stella::bench
+
+// route the pool chunks of stella through the counters as well
+#define STELLA_MALLOC(size) ::stella::bench::CountedMalloc(size)
+#define STELLA_REALLOC(ptr, new_size) ::stella::bench::CountedRealloc(ptr, new_size)
+
+// the replaceable allocation functions count through CountAllocation as well, they are defined
+// out of line in support/allocation.cc, linked into every benchmark executable
+
+#endif //STELLA_BENCH_BENCH_H_
@@ -0,0 +1,135 @@
+//
+// Created by Homin Su on 2023/6/21.
+//
+
+#include "bench.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stella/config_handle.h"
+#include "stella/document.h"
+#include "stella/state.h"
+
+namespace {
+
+constexpr char kScript[] = R"(
+Config = { name = "worker", retries = 3, ratio = 0.25, tags = { "a", "b", "c" } }
+)";
+
+constexpr ::std::size_t kReadsPerThread = 1 << 16;
+
+template<typename Fn>
+void RunThreads(::std::size_t threads, Fn &&fn) {
+  ::std::vector<::std::thread> workers;
+  workers.reserve(threads);
+  for (::std::size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([&fn] {
+      for (::std::size_t n = 0; n < kReadsPerThread; ++n) { fn(); }
+    });
+  }
+  for (auto &worker : workers) { worker.join(); }
+}
+
+// reloads on a background thread for as long as it lives
+class Reloader {
+ private:
+  ::std::atomic<bool> stop_{false};
+  ::std::thread thread_;
+
+ public:
+  template<typename Fn>
+  explicit Reloader(Fn fn) : thread_([this, fn] { while (!stop_.load(::std::memory_order_relaxed)) { fn(); }}) {}
+  ~Reloader() {
+    stop_.store(true, ::std::memory_order_relaxed);
+    thread_.join();
+  }
+};
+
+// what readers do without the handle, a document behind a reader-writer lock
+class LockedConfig {
+ private:
+  mutable ::std::shared_mutex mutex_;
+  ::std::unique_ptr<stella::Document> document_;
+
+ public:
+  void Reload(const ::std::string &file) {
+    stella::State state;
+    state.LoadFile(file);
+    auto document = ::std::make_unique<stella::Document>();
+    if (state.Call() != stella::error::OK || document->Parse(state, "Config") != stella::error::OK) { ::std::abort(); }
+    state.Destroy();
+    ::std::unique_lock<::std::shared_mutex> lock(mutex_);
+    document_.swap(document);
+  }
+
+  [[nodiscard]] LUA_INTEGER Retries() const {
+    ::std::shared_lock<::std::shared_mutex> lock(mutex_);
+    return (*document_)["retries"].GetInteger();
+  }
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  stella::bench::Runner runner(argc, argv);
+
+  const ::std::string file = "bench_config_handle.lua";
+  ::std::ofstream(file) << kScript;
+
+  stella::ConfigHandle::Options options;
+  options.file_ = file;
+  options.name_ = "Config";
+  options.watch_files_ = false;
+  stella::ConfigHandle handle(::std::move(options));
+  if (handle.Start() != stella::error::OK) { ::std::abort(); }
+
+  LockedConfig locked;
+  locked.Reload(file);
+
+  auto read = [&handle] {
+    auto guard = handle.Read();
+    stella::bench::DoNotOptimize((*guard)["retries"].GetInteger());
+  };
+
+  ::std::size_t max_threads = ::std::max(1u, ::std::thread::hardware_concurrency());
+  for (::std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    const ::std::string suffix = "/threads:" + ::std::to_string(threads);
+    const auto items = threads * kReadsPerThread;
+
+    runner.Run("handle/idle" + suffix, items, [&](stella::bench::Iteration &it) {
+      (void) it;
+      RunThreads(threads, read);
+    });
+
+    runner.Run("handle/reloading" + suffix, items, [&](stella::bench::Iteration &it) {
+      it.Pause();
+      Reloader reloader([&handle] { handle.Reload(); });
+      it.Resume();
+      RunThreads(threads, read);
+      it.Pause();
+    });
+
+    runner.Run("shared_mutex/reloading" + suffix, items, [&](stella::bench::Iteration &it) {
+      it.Pause();
+      Reloader reloader([&locked, &file] { locked.Reload(file); });
+      it.Resume();
+      RunThreads(threads, [&locked] { stella::bench::DoNotOptimize(locked.Retries()); });
+      it.Pause();
+    });
+  }
+
+  ::std::remove(file.c_str());
+  return 0;
+}
@@ -0,0 +1,73 @@
+//
+// Created by Homin Su on 2023/6/25.
+//
+
+#include "bench.h"
+
+#include <cstddef>
+#include <cstdlib>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "generator.h"
+#include "stella/batch_loader.h"
+
+namespace {
+
+constexpr ::std::size_t kFiles = 256;
+
+/**
+ * @brief writes a config directory, uniform is kFiles files of the same size, skewed the same total
+ * with a few large files among many small ones, which is where the stealing matters
+ */
+::std::vector<stella::BatchLoader::Source> WriteCorpus(const ::std::filesystem::path &dir, bool skewed) {
+  ::std::filesystem::create_directories(dir);
+  ::std::vector<stella::BatchLoader::Source> sources;
+  sources.reserve(kFiles);
+  for (::std::size_t i = 0; i < kFiles; ++i) {
+    ::std::size_t records = 64;
+    if (skewed) { records = i % 32 == 0 ? 1024 + 32 : 32; }
+    auto key = "config_" + ::std::to_string(i);
+    auto file = (dir / (key + ".lua")).string();
+    ::std::ofstream(file) << stella::bench::Generate(stella::bench::Shape::kRecords, records);
+    sources.push_back({file, "Config", key});
+  }
+  return sources;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  stella::bench::Runner runner(argc, argv);
+
+  const ::std::filesystem::path root = "bench_loader";
+  const ::std::pair<const char *, bool> corpora[] = {{"uniform", false}, {"skewed", true}};
+
+  ::std::size_t max_threads = ::std::max(1u, ::std::thread::hardware_concurrency());
+  for (const auto &[corpus, skewed] : corpora) {
+    auto sources = WriteCorpus(root / corpus, skewed);
+
+    for (::std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+      stella::BatchLoader::Options options;
+      options.threads_ = threads;
+      stella::BatchLoader loader(options);
+
+      runner.Run(::std::string("batch_loader/") + corpus + "/threads:" + ::std::to_string(threads), kFiles,
+                 [&](stella::bench::Iteration &it) {
+                   (void) it;
+                   auto result = loader.Load(sources);
+                   if (!result.Ok()) { ::std::abort(); }
+                   stella::bench::DoNotOptimize(result.GetDocument().GetSize());
+                 });
+    }
+  }
+
+  ::std::filesystem::remove_all(root);
+  return 0;
+}
@@ -0,0 +1,65 @@
+//
+// Created by Homin Su on 2023/6/16.
+//
+
+#include "bench.h"
+
+#include <cstddef>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include "stella/allocator.h"
+#include "stella/value.h"
+
+int main(int argc, char *argv[]) {
+  stella::bench::Runner runner(argc, argv);
+
+  for (::std::size_t size = 4; size <= 65536; size *= 4) {
+    const ::std::string suffix = "/" + ::std::to_string(size);
+
+    ::std::vector<::std::string> keys;
+    keys.reserve(size);
+    for (::std::size_t i = 0; i < size; ++i) { keys.push_back("key_" + ::std::to_string(i)); }
+
+    runner.Run("table_build" + suffix, size, [&](stella::bench::Iteration &it) {
+      stella::MemoryPoolAllocator allocator;
+      stella::Value table(stella::S_TABLE, allocator);
+      for (const auto &key : keys) {
+        table.AddMember(stella::Value(key, allocator), stella::Value(static_cast<LUA_INTEGER>(key.size())));
+      }
+      it.Pause();
+    });
+
+    stella::MemoryPoolAllocator allocator;
+    stella::Value table(stella::S_TABLE, allocator);
+    for (::std::size_t i = 0; i < size; ++i) {
+      table.AddMember(stella::Value(keys[i], allocator), stella::Value(static_cast<LUA_INTEGER>(i)));
+      table.AddMember(i + 1, static_cast<LUA_INTEGER>(i));
+    }
+
+    runner.Run("find_string_hit" + suffix, size, [&](stella::bench::Iteration &it) {
+      (void) it;
+      LUA_INTEGER sum = 0;
+      for (const auto &key : keys) { sum += table.FindMember(key)->value_.GetInteger(); }
+      stella::bench::DoNotOptimize(sum);
+    });
+
+    runner.Run("find_string_miss" + suffix, size, [&](stella::bench::Iteration &it) {
+      (void) it;
+      ::std::size_t missed = 0;
+      for (const auto &key : keys) { missed += table.FindMember(::std::string_view(key).substr(1)) == table.MemberEnd(); }
+      stella::bench::DoNotOptimize(missed);
+    });
+
+    runner.Run("find_integer_hit" + suffix, size, [&](stella::bench::Iteration &it) {
+      (void) it;
+      LUA_INTEGER sum = 0;
+      for (::std::size_t i = 1; i <= size; ++i) { sum += table[i].GetInteger(); }
+      stella::bench::DoNotOptimize(sum);
+    });
+  }
+
+  return 0;
+}
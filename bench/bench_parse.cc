@@ -0,0 +1,356 @@
+//
+// Created by Homin Su on 2023/6/16.
+//
+
+#include "bench.h"
+#include "generator.h"
+
+#include <cstddef>
+#include <cstdlib>
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "stella/bencode_writer.h"
+#include "stella/bind.h"
+#include "stella/chunk_cache.h"
+#include "stella/document.h"
+#include "stella/json_writer.h"
+#include "stella/lua_allocator.h"
+#include "stella/parse_stats.h"
+#include "stella/profiler.h"
+#include "stella/reader.h"
+#include "stella/snapshot.h"
+#include "stella/state.h"
+#include "stella/write_stream.h"
+
+class NullHandler {
+ private:
+  ::std::size_t nodes_ = 0;
+  ::std::size_t stop_after_;
+
+ public:
+  explicit NullHandler(::std::size_t stop_after = SIZE_MAX) : stop_after_(stop_after) {}
+
+  bool Nil() { return Visit(); }
+  bool Bool(bool b) { return (void) b, Visit(); }
+  bool Integer(LUA_INTEGER i) { return (void) i, Visit(); }
+  bool Number(LUA_NUMBER n) { return (void) n, Visit(); }
+  bool String(::std::string_view str) { return (void) str, Visit(); }
+  bool Key(LUA_INTEGER i) { return (void) i, true; }
+  bool Key(::std::string_view str) { return (void) str, true; }
+  bool StartTable() { return Visit(); }
+  bool EndTable() { return true; }
+  bool StartArray(::std::size_t length) { return (void) length, Visit(); }
+  bool EndArray() { return true; }
+
+ private:
+  bool Visit() { return ++nodes_ < stop_after_; }
+};
+
+struct WideHead {
+  LUA_INTEGER key_0 = 0;
+  LUA_INTEGER key_1 = 0;
+  LUA_INTEGER key_2 = 0;
+};
+STELLA_BIND(WideHead, key_0, key_1, key_2)
+
+int main(int argc, char *argv[]) {
+  stella::bench::Runner runner(argc, argv);
+
+  const struct {
+    stella::bench::Shape shape_;
+    ::std::size_t size_;
+  } cases[] = {
+      {stella::bench::Shape::kWide, 100000},
+      {stella::bench::Shape::kDeep, 10000},
+      {stella::bench::Shape::kNumeric, 200000},
+      {stella::bench::Shape::kShortStrings, 100000},
+      {stella::bench::Shape::kHugeStrings, 8},
+      {stella::bench::Shape::kRecords, 50000},
+  };
+
+  for (const auto &c : cases) {
+    const auto src = stella::bench::Generate(c.shape_, c.size_);
+    const ::std::string prefix = stella::bench::ShapeName(c.shape_) + ::std::string("/");
+
+    runner.Run(prefix + "load_call", c.size_, [&](stella::bench::Iteration &it) {
+      (void) it;
+      stella::State state;
+      state.LoadString(src);
+      state.Call();
+      state.Destroy();
+    });
+
+    // profiler overhead, at the default period and at one sample per 100 instructions
+    for (int period : {stella::Profiler::kDefaultPeriod, 100}) {
+      stella::Profiler profiler(period);
+      runner.Run(prefix + "load_call_profiled/period:" + ::std::to_string(period), c.size_,
+                 [&](stella::bench::Iteration &it) {
+                   (void) it;
+                   stella::State state;
+                   state.LoadString(src);
+                   profiler.Start(state);
+                   state.Call();
+                   profiler.Stop(state);
+                   state.Destroy();
+                 });
+    }
+
+    // budget enforcement overhead, an instruction limit alone and with a deadline checked every period
+    for (bool deadline : {false, true}) {
+      stella::State::Budget budget;
+      budget.instructions_ = 1ull << 40;
+      if (deadline) { budget.timeout_ = ::std::chrono::hours(1); }
+      runner.Run(prefix + (deadline ? "load_call_budget_deadline" : "load_call_budget"), c.size_,
+                 [&](stella::bench::Iteration &it) {
+                   (void) it;
+                   stella::State state;
+                   state.LoadString(src);
+                   if (state.Call(budget) != stella::error::OK) { ::std::abort(); }
+                   state.Destroy();
+                 });
+    }
+
+    runner.Run(prefix + "load_call_lua_allocator", c.size_, [&](stella::bench::Iteration &it) {
+      (void) it;
+      stella::LuaAllocator allocator;
+      stella::State state;
+      state.Open(stella::LuaAllocator::Alloc, &allocator);
+      state.Load(src);
+      state.Call();
+      state.Destroy();
+    });
+
+    stella::MemoryChunkCache cache;
+    runner.Run(prefix + "load_call_cached", c.size_, [&](stella::bench::Iteration &it) {
+      (void) it;
+      stella::State state;
+      state.LoadString(src, cache);
+      state.Call();
+      state.Destroy();
+    });
+
+    stella::State state;
+    state.LoadString(src);
+    state.Call();
+
+    runner.Run(prefix + "reader_null", c.size_, [&](stella::bench::Iteration &it) {
+      (void) it;
+      NullHandler handler;
+      state.GetGlobal("Config");
+      if (stella::Reader::Parse(state, handler) != stella::error::OK) { ::std::abort(); }
+    });
+
+    runner.Run(prefix + "reader_document", c.size_, [&](stella::bench::Iteration &it) {
+      stella::Document doc;
+      if (doc.Parse(state, "Config") != stella::error::OK) { ::std::abort(); }
+      it.Pause();
+    });
+
+    runner.Run(prefix + "reader_document_stats", c.size_, [&](stella::bench::Iteration &it) {
+      stella::ParseStats stats;
+      stella::Document doc;
+      if (doc.Parse(state, "Config", stats) != stella::error::OK) { ::std::abort(); }
+      it.Pause();
+    });
+
+    runner.Run(prefix + "reader_document_borrowed", c.size_, [&](stella::bench::Iteration &it) {
+      stella::Document doc;
+      if (doc.Parse(state, "Config", stella::kParseBorrowStringsFlag) != stella::error::OK) { ::std::abort(); }
+      it.Pause();
+    });
+
+    if (c.shape_ == stella::bench::Shape::kWide) {
+      const stella::Projection projection{"key_0", "key_" + ::std::to_string(c.size_ / 2), "missing"};
+      runner.Run(prefix + "reader_document_projected", 3, [&](stella::bench::Iteration &it) {
+        stella::Document doc;
+        if (doc.Parse(state, "Config", projection) != stella::error::OK || doc.GetSize() != 2) { ::std::abort(); }
+        it.Pause();
+      });
+
+      runner.Run(prefix + "bind_struct", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        WideHead head;
+        if (stella::Bind(state, "Config", &head) != stella::error::OK || head.key_2 != 14) { ::std::abort(); }
+      });
+
+      const auto key = "key_" + ::std::to_string(c.size_ / 2);
+      runner.Run(prefix + "lazy_keys_lookup", 1, [&](stella::bench::Iteration &it) {
+        stella::Document doc;
+        if (doc.Parse(state, "Config", stella::kParseLazyFlag | stella::kParseLazyKeysFlag) != stella::error::OK
+            || doc.FindMember(key) == doc.MemberEnd()) { ::std::abort(); }
+        it.Pause();
+      });
+    }
+
+    if (c.shape_ == stella::bench::Shape::kNumeric) {
+      runner.Run(prefix + "get_numbers", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        ::std::vector<LUA_NUMBER> numbers;
+        state.GetGlobal("Config");
+        if (state.GetNumbers(&numbers, -1) != stella::error::OK || numbers.size() != c.size_) { ::std::abort(); }
+        state.Pop();
+        stella::bench::DoNotOptimize(numbers.data());
+      });
+
+      runner.Run(prefix + "get_numbers_adopted", c.size_, [&](stella::bench::Iteration &it) {
+        stella::Numbers numbers;
+        state.GetGlobal("Config");
+        if (state.GetNumbers(&numbers, -1) != stella::error::OK) { ::std::abort(); }
+        state.Pop();
+        stella::Document doc;
+        doc.SetNumbers(::std::move(numbers));
+        it.Pause();
+      });
+    }
+
+    if (c.shape_ == stella::bench::Shape::kRecords) {
+      runner.Run(prefix + "reader_document_interned", c.size_, [&](stella::bench::Iteration &it) {
+        stella::Document doc;
+        if (doc.Parse(state, "Config", stella::kParseInternKeysFlag | stella::kParseInternStringsFlag)
+            != stella::error::OK) { ::std::abort(); }
+        it.Pause();
+      });
+
+      stella::Document doc;
+      if (doc.Parse(state, "Config", stella::kParseInternKeysFlag) != stella::error::OK) { ::std::abort(); }
+
+      runner.Run(prefix + "find_member_by_name", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        LUA_INTEGER sum = 0;
+        for (::std::size_t i = 1; i <= doc.GetSize(); ++i) { sum += doc[i]["id"].GetInteger(); }
+        stella::bench::DoNotOptimize(sum);
+      });
+
+      const auto id = doc.Intern("id");
+      runner.Run(prefix + "find_member_by_symbol", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        LUA_INTEGER sum = 0;
+        for (::std::size_t i = 1; i <= doc.GetSize(); ++i) { sum += doc[i][id].GetInteger(); }
+        stella::bench::DoNotOptimize(sum);
+      });
+    }
+
+    runner.Run(prefix + "document_destroy", c.size_, [&](stella::bench::Iteration &it) {
+      it.Pause();
+      ::std::optional<stella::Document> doc(::std::in_place);
+      if (doc->Parse(state, "Config") != stella::error::OK) { ::std::abort(); }
+      it.Resume();
+      doc.reset();
+    });
+
+    {
+      stella::Document doc;
+      if (doc.Parse(state, "Config") != stella::error::OK) { ::std::abort(); }
+
+      runner.Run(prefix + "find_member", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        ::std::size_t found = 0;
+        if (doc.IsTable()) {
+          for (::std::size_t i = 0; i < c.size_; ++i) {
+            found += doc.FindMember("key_" + ::std::to_string(i)) != doc.MemberEnd();
+          }
+        } else {
+          for (::std::size_t i = 1; i <= doc.GetSize(); ++i) { found += !doc[i].IsNil(); }
+        }
+        stella::bench::DoNotOptimize(found);
+      });
+
+      runner.Run(prefix + "deep_copy", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        stella::Value copy(doc);
+        stella::bench::DoNotOptimize(copy);
+      });
+
+      runner.Run(prefix + "share_update", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        auto version = doc.Share();
+        if (version.IsTable()) { version.MemberBegin()->value_.SetInteger(1); }
+        else { version[1].SetInteger(1); }
+        stella::bench::DoNotOptimize(version);
+      });
+
+      runner.Run(prefix + "refresh_unchanged", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        stella::ChangeSet changes;
+        if (doc.Refresh(state, "Config", &changes) != stella::error::OK || !changes.empty()) { ::std::abort(); }
+      });
+
+      runner.Run(prefix + "write_to_null", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        NullHandler handler;
+        if (!doc.WriteTo(handler)) { ::std::abort(); }
+      });
+
+      stella::StringWriteStream out;
+      runner.Run(prefix + "write_json", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        out.Clear();
+        stella::JsonWriter<stella::StringWriteStream> writer(out);
+        if (!doc.WriteTo(writer)) { ::std::abort(); }
+        stella::bench::DoNotOptimize(out.GetSize());
+      });
+
+      runner.Run(prefix + "write_json_pretty", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        out.Clear();
+        stella::PrettyJsonWriter<stella::StringWriteStream> writer(out);
+        if (!doc.WriteTo(writer)) { ::std::abort(); }
+        stella::bench::DoNotOptimize(out.GetSize());
+      });
+
+      runner.Run(prefix + "write_bencode", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        out.Clear();
+        stella::BencodeWriter<stella::StringWriteStream> writer(out);
+        if (!doc.WriteTo(writer)) { ::std::abort(); }
+        stella::bench::DoNotOptimize(out.GetSize());
+      });
+
+      ::std::string image;
+      if (!stella::SnapshotWriter::Write(doc, &image)) { ::std::abort(); }
+
+      runner.Run(prefix + "snapshot_write", c.size_, [&](stella::bench::Iteration &it) {
+        (void) it;
+        ::std::string out;
+        if (!stella::SnapshotWriter::Write(doc, &out)) { ::std::abort(); }
+        stella::bench::DoNotOptimize(out);
+      });
+
+      runner.Run(prefix + "snapshot_load_find_member", c.size_, [&](stella::bench::Iteration &it) {
+        it.Pause();
+        ::std::string copy = image;
+        it.Resume();
+        stella::Snapshot snapshot;
+        if (snapshot.Load(::std::move(copy)) != stella::error::OK) { ::std::abort(); }
+        auto root = snapshot.Root();
+        ::std::size_t found = 0;
+        if (root.IsTable()) {
+          for (::std::size_t i = 0; i < c.size_; ++i) {
+            found += root.FindMember("key_" + ::std::to_string(i)) != root.MemberEnd();
+          }
+        } else {
+          for (::std::size_t i = 1; i <= root.GetSize(); ++i) { found += !root[i].IsNil(); }
+        }
+        stella::bench::DoNotOptimize(found);
+      });
+    }
+
+    if (c.shape_ == stella::bench::Shape::kDeep) {
+      runner.Run(prefix + "early_abort", 1, [&](stella::bench::Iteration &it) {
+        (void) it;
+        NullHandler handler(64);
+        state.GetGlobal("Config");
+        if (stella::Reader::Parse(state, handler) != stella::error::USER_STOPPED) { ::std::abort(); }
+      });
+    }
+
+    state.Destroy();
+  }
+
+  return 0;
+}
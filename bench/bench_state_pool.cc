@@ -0,0 +1,83 @@
+//
+// Created by Homin Su on 2023/6/17.
+//
+
+#include "bench.h"
+
+#include <cstddef>
+#include <cstdlib>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stella/document.h"
+#include "stella/state.h"
+#include "stella/state_pool.h"
+
+namespace {
+
+constexpr char kScript[] = R"(
+Config = { name = "worker", retries = 3, ratio = 0.25, tags = { "a", "b", "c" } }
+)";
+
+constexpr ::std::size_t kEvaluationsPerThread = 256;
+
+// one short-lived evaluation, as a request worker would do it
+void Evaluate(stella::State &state) {
+  state.Call();
+  stella::Document doc;
+  if (doc.Parse(state, "Config") != stella::error::OK) { ::std::abort(); }
+  stella::bench::DoNotOptimize(doc["retries"].GetInteger());
+}
+
+template<typename Fn>
+void RunThreads(::std::size_t threads, Fn &&fn) {
+  ::std::vector<::std::thread> workers;
+  workers.reserve(threads);
+  for (::std::size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([&fn] {
+      for (::std::size_t n = 0; n < kEvaluationsPerThread; ++n) { fn(); }
+    });
+  }
+  for (auto &worker : workers) { worker.join(); }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  stella::bench::Runner runner(argc, argv);
+
+  ::std::size_t max_threads = ::std::max(1u, ::std::thread::hardware_concurrency());
+  for (::std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    const ::std::string suffix = "/threads:" + ::std::to_string(threads);
+    const auto items = threads * kEvaluationsPerThread;
+
+    runner.Run("fresh_state" + suffix, items, [&](stella::bench::Iteration &it) {
+      (void) it;
+      RunThreads(threads, [] {
+        stella::State state;
+        state.Open();
+        state.Load(kScript);
+        Evaluate(state);
+        state.Destroy();
+      });
+    });
+
+    stella::StatePool::Options options;
+    options.initial_states_ = threads;
+    stella::StatePool pool(::std::move(options));
+
+    runner.Run("pool" + suffix, items, [&](stella::bench::Iteration &it) {
+      (void) it;
+      RunThreads(threads, [&pool] {
+        auto state = pool.Acquire();
+        state->Load(kScript);
+        Evaluate(*state);
+      });
+    });
+  }
+
+  return 0;
+}
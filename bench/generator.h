@@ -0,0 +1,92 @@
+//
+// Created by Homin Su on 2023/6/16.
+//
+
+#ifndef STELLA_BENCH_GENERATOR_H_
+#define STELLA_BENCH_GENERATOR_H_
+
+#include <cstddef>
+
+#include <string>
+
+namespace stella::bench {
+
+/**
+ * @brief shapes of the synthetic configs, each one assigns a global named Config
+ */
+enum class Shape {
+  kWide,         // one flat table with n string keys
+  kDeep,         // n nested tables, built by a loop since the lua parser limits constructor nesting
+  kNumeric,      // a sequence of n numbers, integers and floats interleaved
+  kShortStrings, // a sequence of n short strings
+  kHugeStrings,  // n strings of 1 MiB each
+  kRecords,      // a sequence of n records sharing the same keys
+};
+
+inline const char *ShapeName(Shape shape) {
+  switch (shape) {
+    case Shape::kWide: return "wide";
+    case Shape::kDeep: return "deep";
+    case Shape::kNumeric: return "numeric";
+    case Shape::kShortStrings: return "short_strings";
+    case Shape::kHugeStrings: return "huge_strings";
+    case Shape::kRecords: return "records";
+    default: return "unknown";
+  }
+}
+
+inline ::std::string Generate(Shape shape, ::std::size_t n) {
+  ::std::string src;
+  switch (shape) {
+    case Shape::kWide:
+      src = "Config = {\n";
+      for (::std::size_t i = 0; i < n; ++i) {
+        src += "  key_" + ::std::to_string(i) + " = " + ::std::to_string(i * 7) + ",\n";
+      }
+      src += "}\n";
+      break;
+    case Shape::kDeep:
+      src = "local t = { v = 0 }\nConfig = t\n"
+            "for i = 1, " + ::std::to_string(n) + " do\n"
+            "  local c = { v = i }\n  t.c = c\n  t = c\nend\n";
+      break;
+    case Shape::kNumeric:
+      src = "Config = {\n";
+      for (::std::size_t i = 0; i < n; ++i) {
+        src += i % 2 ? ::std::to_string(i) + ".5," : ::std::to_string(i) + ",";
+        if (i % 16 == 15) { src += "\n"; }
+      }
+      src += "}\n";
+      break;
+    case Shape::kShortStrings:
+      src = "Config = {\n";
+      for (::std::size_t i = 0; i < n; ++i) {
+        src += "\"s" + ::std::to_string(i) + "\",";
+        if (i % 16 == 15) { src += "\n"; }
+      }
+      src += "}\n";
+      break;
+    case Shape::kHugeStrings:
+      src = "Config = {\n";
+      for (::std::size_t i = 0; i < n; ++i) {
+        src += "  \"" + ::std::string(1u << 20, static_cast<char>('a' + i % 26)) + "\",\n";
+      }
+      src += "}\n";
+      break;
+    case Shape::kRecords:
+      src = "Config = {\n";
+      for (::std::size_t i = 0; i < n; ++i) {
+        src += "  { id = " + ::std::to_string(i) + ", name = \"user_" + ::std::to_string(i) + "\", score = "
+            + ::std::to_string(i % 100) + ".5, region = \"" + (i % 3 ? "eu-west" : "us-east") + "\", active = "
+            + (i % 2 ? "true" : "false") + " },\n";
+      }
+      src += "}\n";
+      break;
+    default: break;
+  }
+  return src;
+}
+
+} // namespace stella::bench
+
+#endif //STELLA_BENCH_GENERATOR_H_
@@ -0,0 +1,30 @@
+//
+// Created by Homin Su on 2023/6/16.
+//
+
+#include "../bench.h"
+
+#include <cstddef>
+#include <cstdlib>
+
+#include <new>
+
+// replaceable allocation functions, kept out of the headers so the compiler never sees the
+// malloc behind operator new and the free behind operator delete at the same time
+
+void *operator new(::std::size_t size) {
+  ::stella::bench::CountAllocation(size);
+  if (void *ptr = ::std::malloc(size == 0 ? 1 : size)) { return ptr; }
+  throw ::std::bad_alloc();
+}
+
+void *operator new[](::std::size_t size) {
+  ::stella::bench::CountAllocation(size);
+  if (void *ptr = ::std::malloc(size == 0 ? 1 : size)) { return ptr; }
+  throw ::std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { ::std::free(ptr); }
+void operator delete[](void *ptr) noexcept { ::std::free(ptr); }
+void operator delete(void *ptr, ::std::size_t) noexcept { ::std::free(ptr); }
+void operator delete[](void *ptr, ::std::size_t) noexcept { ::std::free(ptr); }
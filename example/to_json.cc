@@ -2,35 +2,15 @@
 // Created by Homin Su on 2023/6/12.
 //
 
-#include <string>
+#include <cstdio>
+#include <cstdlib>
 
 #include "sample.h"
-#include "stella/document.h"
 #include "stella/exception.h"
-#include "stella/non_copyable.h"
+#include "stella/json_writer.h"
+#include "stella/reader.h"
 #include "stella/state.h"
-
-#include "neujson/file_write_stream.h"
-#include "neujson/pretty_writer.h"
-
-template<typename Handler>
-class ToJSON : stella::NonCopyable {
- private:
-  Handler &handler_;
-
- public:
-  explicit ToJSON(Handler &handler) : handler_(handler) {}
-
-  bool Nil() { return handler_.Null(); }
-  bool Bool(bool b) { return handler_.Bool(b); }
-  bool Integer(LUA_INTEGER i) { return handler_.Int64(i); }
-  bool Number(LUA_NUMBER n) { return handler_.Double(n); }
-  bool String(std::string_view str) { return handler_.String(str); }
-  bool Key(std::string_view str) { return handler_.Key(str); }
-  bool Key(LUA_INTEGER i) { return handler_.Key(::std::to_string(i)); }
-  bool StartTable() { return handler_.StartObject(); }
-  bool EndTable() { return handler_.EndObject(); }
-};
+#include "stella/write_stream.h"
 
 int main(int argc, char *argv[]) {
   (void) argc;
@@ -40,17 +20,18 @@ int main(int argc, char *argv[]) {
   state.LoadString(kSample[0]);
   state.Call();
 
-  neujson::FileWriteStream out(stdout);
-  neujson::PrettyWriter pretty_writer(out);
-  pretty_writer.SetIndent(' ', 2);
-  ToJSON to_json(pretty_writer);
+  stella::FileWriteStream out(stdout);
+  stella::PrettyJsonWriter<stella::FileWriteStream> writer(out);
+  writer.SetIndent(' ', 2);
 
+  // straight from the lua stack, without building a DOM
   state.GetGlobal("Application");
-  auto err = stella::Reader::Parse(state, to_json);
+  auto err = stella::Reader::Parse(state, writer);
   if (err != stella::error::OK) {
     puts(stella::ParseErrorStr(err));
     return EXIT_FAILURE;
   }
+  out.Put('\n');
 
   return 0;
 }
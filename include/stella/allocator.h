@@ -0,0 +1,251 @@
+//
+// Created by Homin Su on 2023/6/14.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_ALLOCATOR_H_
+#define STELLA_INCLUDE_STELLA_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <new>
+#include <type_traits>
+
+#include "non_copyable.h"
+#include "stella.h"
+
+/**
+ * @brief C runtime entry points, may be overridden to route or count every allocation
+ */
+#ifndef STELLA_MALLOC
+#define STELLA_MALLOC(size) ::std::malloc(size)
+#endif // STELLA_MALLOC
+#ifndef STELLA_REALLOC
+#define STELLA_REALLOC(ptr, new_size) ::std::realloc(ptr, new_size)
+#endif // STELLA_REALLOC
+#ifndef STELLA_FREE
+#define STELLA_FREE(ptr) ::std::free(ptr)
+#endif // STELLA_FREE
+
+namespace stella {
+
+/**
+ * @brief round up to the maximum fundamental alignment
+ */
+#ifndef STELLA_ALIGN
+#define STELLA_ALIGN(x) \
+  (((x) + static_cast<::std::size_t>(alignof(::std::max_align_t) - 1u)) \
+      & ~static_cast<::std::size_t>(alignof(::std::max_align_t) - 1u))
+#endif // STELLA_ALIGN
+
+/**
+ * @brief C runtime allocator, every block is released individually
+ */
+class CrtAllocator {
+ public:
+  static constexpr bool kNeedFree = true;
+
+  void *Malloc(::std::size_t size) {
+    if (size) { return STELLA_MALLOC(size); }
+    return nullptr;
+  }
+
+  void *Realloc(void *ptr, ::std::size_t orig_size, ::std::size_t new_size) {
+    (void) orig_size;
+    if (new_size == 0) {
+      STELLA_FREE(ptr);
+      return nullptr;
+    }
+    return STELLA_REALLOC(ptr, new_size);
+  }
+
+  static void Free(void *ptr) noexcept { STELLA_FREE(ptr); }
+};
+
+/**
+ * @brief bump allocator over a list of chunks, blocks are never released individually,
+ * every chunk is released at once when the allocator is cleared or destroyed
+ */
+class MemoryPoolAllocator : NonCopyable {
+ private:
+  struct ChunkHeader {
+    ::std::size_t capacity_;
+    ::std::size_t size_;
+    ChunkHeader *next_;
+  };
+
+  static constexpr ::std::size_t kHeaderSize = STELLA_ALIGN(sizeof(ChunkHeader));
+
+  ChunkHeader *chunk_head_ = nullptr;
+  ::std::size_t chunk_capacity_;
+  void *user_buffer_ = nullptr;
+
+ public:
+  static constexpr bool kNeedFree = false;
+  static constexpr ::std::size_t kDefaultChunkCapacity = 64 * 1024;
+
+  explicit MemoryPoolAllocator(::std::size_t chunk_capacity = kDefaultChunkCapacity)
+      : chunk_capacity_(chunk_capacity) {}
+  MemoryPoolAllocator(void *buffer, ::std::size_t size, ::std::size_t chunk_capacity = kDefaultChunkCapacity);
+  ~MemoryPoolAllocator();
+
+  void Clear();
+
+  [[nodiscard]] ::std::size_t Capacity() const;
+  [[nodiscard]] ::std::size_t Size() const;
+
+  void *Malloc(::std::size_t size);
+  void *Realloc(void *ptr, ::std::size_t orig_size, ::std::size_t new_size);
+  static void Free(void *ptr) noexcept { (void) ptr; }
+
+ private:
+  bool AddChunk(::std::size_t capacity);
+  [[nodiscard]] static char *ChunkData(ChunkHeader *chunk) { return reinterpret_cast<char *>(chunk) + kHeaderSize; }
+};
+
+inline MemoryPoolAllocator::MemoryPoolAllocator(void *buffer, ::std::size_t size, ::std::size_t chunk_capacity)
+    : chunk_capacity_(chunk_capacity), user_buffer_(buffer) {
+  STELLA_ASSERT(buffer != nullptr);
+  STELLA_ASSERT(size > kHeaderSize);
+  STELLA_ASSERT(reinterpret_cast<::std::uintptr_t>(buffer) % alignof(::std::max_align_t) == 0);
+  chunk_head_ = static_cast<ChunkHeader *>(buffer);
+  chunk_head_->capacity_ = size - kHeaderSize;
+  chunk_head_->size_ = 0;
+  chunk_head_->next_ = nullptr;
+}
+
+inline MemoryPoolAllocator::~MemoryPoolAllocator() {
+  Clear();
+}
+
+inline void MemoryPoolAllocator::Clear() {
+  while (chunk_head_ != nullptr && chunk_head_ != user_buffer_) {
+    ChunkHeader *next = chunk_head_->next_;
+    CrtAllocator::Free(chunk_head_);
+    chunk_head_ = next;
+  }
+  if (chunk_head_ != nullptr && chunk_head_ == user_buffer_) {
+    chunk_head_->size_ = 0;
+  }
+}
+
+inline ::std::size_t MemoryPoolAllocator::Capacity() const {
+  ::std::size_t capacity = 0;
+  for (auto *chunk = chunk_head_; chunk != nullptr; chunk = chunk->next_) {
+    capacity += chunk->capacity_;
+  }
+  return capacity;
+}
+
+inline ::std::size_t MemoryPoolAllocator::Size() const {
+  ::std::size_t size = 0;
+  for (auto *chunk = chunk_head_; chunk != nullptr; chunk = chunk->next_) {
+    size += chunk->size_;
+  }
+  return size;
+}
+
+inline void *MemoryPoolAllocator::Malloc(::std::size_t size) {
+  if (!size) { return nullptr; }
+
+  size = STELLA_ALIGN(size);
+  if (chunk_head_ == nullptr || chunk_head_->size_ + size > chunk_head_->capacity_) {
+    if (!AddChunk(chunk_capacity_ > size ? chunk_capacity_ : size)) { return nullptr; }
+  }
+
+  void *buffer = ChunkData(chunk_head_) + chunk_head_->size_;
+  chunk_head_->size_ += size;
+  return buffer;
+}
+
+inline void *MemoryPoolAllocator::Realloc(void *ptr, ::std::size_t orig_size, ::std::size_t new_size) {
+  if (ptr == nullptr) { return Malloc(new_size); }
+  if (new_size == 0) { return nullptr; }
+
+  orig_size = STELLA_ALIGN(orig_size);
+  new_size = STELLA_ALIGN(new_size);
+
+  // do not shrink if new size is smaller than original
+  if (orig_size >= new_size) { return ptr; }
+
+  // simply expand it if it is the last allocation and there is sufficient space
+  if (ptr == ChunkData(chunk_head_) + chunk_head_->size_ - orig_size) {
+    ::std::size_t increment = new_size - orig_size;
+    if (chunk_head_->size_ + increment <= chunk_head_->capacity_) {
+      chunk_head_->size_ += increment;
+      return ptr;
+    }
+  }
+
+  // realloc process: allocate and copy memory, do not free original buffer
+  if (void *new_buffer = Malloc(new_size)) {
+    if (orig_size) { ::std::memcpy(new_buffer, ptr, orig_size); }
+    return new_buffer;
+  }
+  return nullptr;
+}
+
+inline bool MemoryPoolAllocator::AddChunk(::std::size_t capacity) {
+  auto *chunk = static_cast<ChunkHeader *>(CrtAllocator().Malloc(kHeaderSize + capacity));
+  if (chunk == nullptr) { return false; }
+  chunk->capacity_ = capacity;
+  chunk->size_ = 0;
+  chunk->next_ = chunk_head_;
+  chunk_head_ = chunk;
+  return true;
+}
+
+/**
+ * @brief standard library adapter, draws from a MemoryPoolAllocator when one is bound,
+ * otherwise from the C runtime
+ */
+template<typename T>
+class StdAllocator {
+ private:
+  template<typename U> friend
+  class StdAllocator;
+
+  MemoryPoolAllocator *allocator_;
+
+ public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = ::std::true_type;
+  using propagate_on_container_move_assignment = ::std::true_type;
+  using propagate_on_container_swap = ::std::true_type;
+
+  StdAllocator() noexcept: allocator_(nullptr) {}
+  explicit StdAllocator(MemoryPoolAllocator *allocator) noexcept: allocator_(allocator) {}
+  template<typename U>
+  StdAllocator(const StdAllocator<U> &other) noexcept: allocator_(other.allocator_) {} // NOLINT
+
+  [[nodiscard]] MemoryPoolAllocator *pool() const { return allocator_; }
+
+  T *allocate(::std::size_t n);
+  void deallocate(T *ptr, ::std::size_t n) noexcept;
+
+  template<typename U>
+  bool operator==(const StdAllocator<U> &rhs) const noexcept { return allocator_ == rhs.allocator_; }
+  template<typename U>
+  bool operator!=(const StdAllocator<U> &rhs) const noexcept { return allocator_ != rhs.allocator_; }
+};
+
+template<typename T>
+inline T *StdAllocator<T>::allocate(::std::size_t n) {
+  static_assert(alignof(T) <= alignof(::std::max_align_t), "over-aligned type");
+  void *ptr = allocator_ != nullptr ? allocator_->Malloc(n * sizeof(T)) : CrtAllocator().Malloc(n * sizeof(T));
+  if (ptr == nullptr && n != 0) { throw ::std::bad_alloc(); }
+  return static_cast<T *>(ptr);
+}
+
+template<typename T>
+inline void StdAllocator<T>::deallocate(T *ptr, ::std::size_t n) noexcept {
+  (void) n;
+  if (allocator_ != nullptr) { MemoryPoolAllocator::Free(ptr); }
+  else { CrtAllocator::Free(ptr); }
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_ALLOCATOR_H_
@@ -0,0 +1,233 @@
+//
+// Created by Homin Su on 2023/6/25.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_BATCH_LOADER_H_
+#define STELLA_INCLUDE_STELLA_BATCH_LOADER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "allocator.h"
+#include "document.h"
+#include "exception.h"
+#include "lua_allocator.h"
+#include "non_copyable.h"
+#include "state.h"
+#include "stella.h"
+
+namespace stella {
+
+/**
+ * @brief loads a set of config files concurrently and merges them into one document:
+ *
+ *   stella::BatchLoader loader;
+ *   auto result = loader.Load({{"net.lua", "Net"}, {"db.lua", "Database", "db"}});
+ *   for (const auto &failure : result.Failures()) { ... }
+ *   auto port = result.GetDocument()["Net"]["Port"].GetInteger();
+ *
+ * every file runs in a state of its own, on a LuaAllocator, under the budget of the options, and is
+ * parsed into the pool of the worker thread. The files are dealt to the workers largest first, a
+ * worker that runs out of files steals from the others, so a few large files do not leave the
+ * other threads idle. The calling thread is one of the workers.
+ *
+ * the merge runs in the order of the sources once all are parsed, a failed file and a file whose key
+ * is already taken are reported and left out, the result does not depend on the scheduling.
+ */
+class BatchLoader : NonCopyable {
+ public:
+  struct Source {
+    ::std::string file_;
+    ::std::string name_;   // global parsed, required, _G holds the standard library
+    ::std::string key_;    // key of the value in the merged document, name_ when empty
+  };
+
+  struct Options {
+    ::std::size_t threads_ = 0;            // 0 for one per hardware thread, never more than the files
+    unsigned flags_ = kParseDefaultFlags;  // neither borrowed strings nor lazy tables, the states are closed
+    State::Budget budget_;                 // of every file, memory_ included
+  };
+
+  struct Failure {
+    ::std::size_t index_;                  // in the sources
+    error::ParseError err_;                // OPEN_FAILED when unreadable, BAD_KEY without a name or when the
+                                           // key is taken, CALL_FAILED for an exception that is not a stella one
+  };
+
+  class Result {
+   private:
+    friend class BatchLoader;
+
+    // the values were parsed into these, they must outlive the document
+    ::std::vector<::std::unique_ptr<MemoryPoolAllocator>> pools_;
+    Document document_;
+    ::std::vector<Failure> failures_;
+
+   public:
+    Result() = default;
+    Result(Result &&other) noexcept = default;
+
+    Document &GetDocument() { return document_; }
+    [[nodiscard]] const Document &GetDocument() const { return document_; }
+    [[nodiscard]] const ::std::vector<Failure> &Failures() const { return failures_; }
+    [[nodiscard]] bool Ok() const { return failures_.empty(); }
+  };
+
+  explicit BatchLoader(Options options) : options_(::std::move(options)) {
+    STELLA_ASSERT(!(options_.flags_ & (kParseBorrowStringsFlag | kParseLazyFlag)) && "the states are closed");
+  }
+  BatchLoader() : BatchLoader(Options()) {}
+
+  [[nodiscard]] Result Load(const ::std::vector<Source> &sources) const;
+
+  /**
+   * @brief key of a source in the merged document
+   */
+  [[nodiscard]] static ::std::string KeyOf(const Source &source);
+
+ private:
+  struct alignas(64) Queue {
+    ::std::mutex mutex_;
+    ::std::deque<::std::size_t> files_;
+  };
+  struct Slot {
+    Value value_;
+    error::ParseError err_ = error::OK;
+  };
+
+  Options options_;
+
+  bool Next(Queue *queues, ::std::size_t count, ::std::size_t home, ::std::size_t *index) const;
+  error::ParseError LoadOne(const Source &source, MemoryPoolAllocator *pool, Value *value) const;
+};
+
+inline BatchLoader::Result BatchLoader::Load(const ::std::vector<Source> &sources) const {
+  auto threads = options_.threads_ != 0 ? options_.threads_ : ::std::max(1u, ::std::thread::hardware_concurrency());
+  threads = ::std::max(::std::size_t{1}, ::std::min(threads, sources.size()));
+
+  // longest processing time first, the file size stands in for the time
+  ::std::vector<::std::pair<::std::uintmax_t, ::std::size_t>> order;
+  order.reserve(sources.size());
+  for (::std::size_t i = 0; i < sources.size(); ++i) {
+    ::std::error_code ec;
+    auto size = ::std::filesystem::file_size(sources[i].file_, ec);
+    order.emplace_back(ec ? 0 : size, i);
+  }
+  ::std::stable_sort(order.begin(), order.end(), [](const auto &lhs, const auto &rhs) {
+    return lhs.first > rhs.first;
+  });
+
+  auto queues = ::std::make_unique<Queue[]>(threads);
+  for (::std::size_t i = 0; i < order.size(); ++i) { queues[i % threads].files_.push_back(order[i].second); }
+
+  Result result;
+  for (::std::size_t i = 0; i < threads; ++i) { result.pools_.push_back(::std::make_unique<MemoryPoolAllocator>()); }
+
+  ::std::vector<Slot> slots(sources.size());
+  auto work = [&](::std::size_t home) {
+    ::std::size_t index;
+    while (Next(queues.get(), threads, home, &index)) {
+      auto &slot = slots[index];
+      // an exception must not leave the worker, it would terminate the process
+      try {
+        slot.err_ = LoadOne(sources[index], result.pools_[home].get(), &slot.value_);
+      } catch (const ::std::bad_alloc &) {
+        slot.err_ = error::OUT_OF_MEMORY;
+      } catch (const Exception &e) {
+        slot.err_ = e.err();
+      } catch (...) {
+        slot.err_ = error::CALL_FAILED;
+      }
+      if (slot.err_ != error::OK) { slot.value_ = Value(); }
+    }
+  };
+
+  ::std::vector<::std::thread> workers;
+  workers.reserve(threads - 1);
+  for (::std::size_t i = 1; i < threads; ++i) { workers.emplace_back(work, i); }
+  work(0);
+  for (auto &worker : workers) { worker.join(); }
+
+  auto &document = result.document_;
+  document.SetTable(document.GetAllocator());
+  for (::std::size_t i = 0; i < sources.size(); ++i) {
+    auto err = slots[i].err_;
+    auto key = KeyOf(sources[i]);
+    if (err == error::OK && document.FindMember(::std::string_view(key)) != document.MemberEnd()) {
+      err = error::BAD_KEY;
+    }
+    if (err != error::OK) {
+      result.failures_.push_back(Failure{i, err});
+      continue;
+    }
+    document.AddMember(Value(key, document.GetAllocator()), ::std::move(slots[i].value_));
+  }
+  return result;
+}
+
+inline ::std::string BatchLoader::KeyOf(const Source &source) {
+  return source.key_.empty() ? source.name_ : source.key_;
+}
+
+/**
+ * @brief pops the next file of the home queue, or steals the last file of another queue, there is
+ * nothing left anywhere once every queue has been seen empty since the files are all queued up front
+ */
+inline bool BatchLoader::Next(Queue *queues, ::std::size_t count, ::std::size_t home, ::std::size_t *index) const {
+  for (::std::size_t i = 0; i < count; ++i) {
+    auto &queue = queues[(home + i) % count];
+    ::std::lock_guard<::std::mutex> lock(queue.mutex_);
+    if (queue.files_.empty()) { continue; }
+    if (i == 0) {
+      *index = queue.files_.front();
+      queue.files_.pop_front();
+    } else {
+      *index = queue.files_.back();
+      queue.files_.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+inline error::ParseError BatchLoader::LoadOne(const Source &source, MemoryPoolAllocator *pool, Value *value) const {
+  if (source.name_.empty()) { return error::BAD_KEY; }
+  ::std::string script;
+  if (!State::ReadFile(source.file_, &script)) { return error::OPEN_FAILED; }
+
+  LuaAllocator allocator;
+  State state;
+  if (!state.Open(LuaAllocator::Alloc, &allocator)) { return error::OPEN_FAILED; }
+
+  auto err = error::CALL_FAILED;
+  try {
+    err = state.Load(script, "@" + source.file_) ? state.Call(options_.budget_) : error::CALL_FAILED;
+    if (err == error::OK) {
+      Document document(pool);
+      err = document.Parse(state, source.name_, options_.flags_);
+      if (err == error::OK) { *value = ::std::move(static_cast<Value &>(document)); }
+    }
+  } catch (...) {
+    state.Destroy();
+    throw;
+  }
+  state.Destroy();
+  return err;
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_BATCH_LOADER_H_
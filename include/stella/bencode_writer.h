@@ -0,0 +1,200 @@
+//
+// Created by Homin Su on 2023/6/22.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_BENCODE_WRITER_H_
+#define STELLA_INCLUDE_STELLA_BENCODE_WRITER_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <charconv>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "non_copyable.h"
+#include "stella.h"
+#include "write_stream.h"
+
+#include <lua.hpp>
+
+namespace stella {
+
+/**
+ * @brief bencode output of the handler protocol, driven by Value::WriteTo or Reader::Parse.
+ *
+ * bencode wants the keys of a dictionary sorted as raw bytes, lua tables are not, so a dictionary is
+ * written to a scratch buffer and its entries reordered when it ends, the stream only gets whole
+ * root dictionaries. Integer keys become their decimal strings, booleans 0 and 1, nil an empty
+ * string, and a number without an integral value its shortest decimal text as a string.
+ */
+template<typename Stream>
+class BencodeWriter : NonCopyable {
+ private:
+  struct Level {
+    bool in_array_;
+    ::std::size_t begin_;    // first byte of the entries in the scratch buffer
+    ::std::size_t entries_;  // first entry of the level
+    bool sorted_;
+  };
+  struct Entry {
+    ::std::size_t begin_;
+    ::std::size_t key_;
+    ::std::size_t key_length_;
+  };
+
+  Stream &stream_;
+  StringWriteStream scratch_;
+  ::std::vector<Level> stack_;
+  ::std::vector<Entry> entries_;
+  ::std::size_t dicts_ = 0;  // open dictionaries, the output goes to the scratch buffer while any
+
+ public:
+  explicit BencodeWriter(Stream &stream) : stream_(stream) {}
+
+  bool Nil() {
+    Emit([](auto &out) { out.Puts("0:"); });
+    return Done();
+  }
+  bool Bool(bool b) {
+    Emit([b](auto &out) { out.Puts(b ? "i1e" : "i0e"); });
+    return Done();
+  }
+  bool Integer(LUA_INTEGER i) {
+    Emit([i](auto &out) { PutInt(out, i); });
+    return Done();
+  }
+  bool Number(LUA_NUMBER n);
+  bool String(::std::string_view str) {
+    Emit([str](auto &out) { PutString(out, str); });
+    return Done();
+  }
+  bool Key(LUA_INTEGER i) {
+    char buffer[24];
+    auto *end = ::std::to_chars(buffer, buffer + sizeof(buffer), i).ptr;
+    return Key(::std::string_view(buffer, static_cast<::std::size_t>(end - buffer)));
+  }
+  bool Key(::std::string_view str);
+  bool StartTable() {
+    Emit([](auto &out) { out.Put('d'); });
+    ++dicts_;
+    stack_.push_back(Level{false, scratch_.GetSize(), entries_.size(), true});
+    return true;
+  }
+  bool EndTable();
+  bool StartArray(::std::size_t length) {
+    (void) length;
+    Emit([](auto &out) { out.Put('l'); });
+    stack_.push_back(Level{true, 0, 0, true});
+    return true;
+  }
+  bool EndArray() {
+    STELLA_ASSERT(!stack_.empty() && stack_.back().in_array_);
+    stack_.pop_back();
+    Emit([](auto &out) { out.Put('e'); });
+    return Done();
+  }
+
+  [[nodiscard]] bool IsComplete() const { return stack_.empty(); }
+
+ private:
+  template<typename Fn>
+  void Emit(Fn fn) {
+    if (dicts_ > 0) { fn(scratch_); }
+    else { fn(stream_); }
+  }
+  template<typename Out>
+  static void PutInt(Out &out, LUA_INTEGER i) {
+    out.Put('i');
+    PutInteger(out, i);
+    out.Put('e');
+  }
+  template<typename Out>
+  static void PutString(Out &out, ::std::string_view str) {
+    PutInteger(out, static_cast<LUA_INTEGER>(str.size()));
+    out.Put(':');
+    out.Puts(str);
+  }
+  [[nodiscard]] ::std::string_view KeyOf(const Entry &entry) const {
+    return scratch_.GetStringView().substr(entry.key_, entry.key_length_);
+  }
+  bool Done() {
+    if (stack_.empty()) { stream_.Flush(); }
+    return true;
+  }
+};
+
+template<typename Stream>
+inline bool BencodeWriter<Stream>::Number(LUA_NUMBER n) {
+  // the integral values that fit an integer, 2^63 itself does not
+  constexpr auto kLimit = static_cast<LUA_NUMBER>(static_cast<LUA_NUMBER>(1ull << 62) * 2);
+  if (::std::floor(n) == n && n >= -kLimit && n < kLimit) { return Integer(static_cast<LUA_INTEGER>(n)); }
+
+  StringWriteStream text;
+  if (::std::isfinite(n)) { PutNumber(text, n); }
+  else { text.Puts(::std::isnan(n) ? "nan" : (n > 0 ? "inf" : "-inf")); }
+  return String(text.GetStringView());
+}
+
+template<typename Stream>
+inline bool BencodeWriter<Stream>::Key(::std::string_view str) {
+  STELLA_ASSERT(!stack_.empty() && !stack_.back().in_array_);
+  auto &level = stack_.back();
+  auto begin = scratch_.GetSize();
+  PutString(scratch_, str);
+  Entry entry{begin, scratch_.GetSize() - str.size(), str.size()};
+  if (level.sorted_ && entries_.size() > level.entries_ && KeyOf(entries_.back()) > str) { level.sorted_ = false; }
+  entries_.push_back(entry);
+  return true;
+}
+
+/**
+ * @brief puts the entries in key order, an entry spans its key and its value up to the next entry
+ */
+template<typename Stream>
+inline bool BencodeWriter<Stream>::EndTable() {
+  STELLA_ASSERT(!stack_.empty() && !stack_.back().in_array_);
+  auto level = stack_.back();
+  stack_.pop_back();
+
+  if (!level.sorted_) {
+    auto first = entries_.begin() + static_cast<::std::ptrdiff_t>(level.entries_);
+    auto end = scratch_.GetSize();
+    ::std::vector<::std::pair<::std::size_t, ::std::size_t>> spans;
+    spans.reserve(static_cast<::std::size_t>(entries_.end() - first));
+    for (auto it = first; it != entries_.end(); ++it) {
+      spans.emplace_back(it->begin_, it + 1 == entries_.end() ? end : (it + 1)->begin_);
+    }
+    ::std::vector<::std::size_t> order(spans.size());
+    for (::std::size_t i = 0; i < order.size(); ++i) { order[i] = i; }
+    ::std::stable_sort(order.begin(), order.end(), [&](::std::size_t lhs, ::std::size_t rhs) {
+      return KeyOf(first[static_cast<::std::ptrdiff_t>(lhs)]) < KeyOf(first[static_cast<::std::ptrdiff_t>(rhs)]);
+    });
+
+    auto content = scratch_.GetStringView().substr(level.begin_);
+    ::std::unique_ptr<char[]> sorted(new char[content.size()]);
+    auto *ptr = sorted.get();
+    for (auto i : order) {
+      auto length = spans[i].second - spans[i].first;
+      ::std::memcpy(ptr, content.data() + (spans[i].first - level.begin_), length);
+      ptr += length;
+    }
+    scratch_.Pop(content.size());
+    scratch_.Puts({sorted.get(), content.size()});
+  }
+  entries_.resize(level.entries_);
+
+  scratch_.Put('e');
+  if (--dicts_ == 0) {
+    stream_.Puts(scratch_.GetStringView());
+    scratch_.Clear();
+  }
+  return Done();
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_BENCODE_WRITER_H_
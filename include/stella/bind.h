@@ -0,0 +1,475 @@
+//
+// Created by Homin Su on 2023/6/21.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_BIND_H_
+#define STELLA_INCLUDE_STELLA_BIND_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "exception.h"
+#include "handler.h"
+#include "reader.h"
+#include "state.h"
+#include "stella.h"
+
+#include <lua.hpp>
+
+/**
+ * @brief declares the fields of a struct bound by stella::Bind, at most 32, next to the struct
+ * and in its namespace:
+ *
+ *   struct Window {
+ *     int width_ = 0;
+ *     ::std::string title_;
+ *     ::std::optional<::std::vector<int>> sizes_;
+ *     ::std::vector<Window> children_;
+ *   };
+ *   STELLA_BIND(Window, width_, title_, sizes_, children_)
+ *
+ * the lua key of a field is its name, use STELLA_BIND_AS to pick another one:
+ *
+ *   STELLA_BIND_AS(Window, (width_, "Width"), (title_, "Title"))
+ */
+#define STELLA_BIND(TYPE, ...) \
+  [[maybe_unused]] inline constexpr auto StellaBindFields(const TYPE *) { \
+    return ::std::make_tuple(STELLA_BIND_FOR_EACH(STELLA_BIND_FIELD, TYPE, __VA_ARGS__)); \
+  }
+
+#define STELLA_BIND_AS(TYPE, ...) \
+  [[maybe_unused]] inline constexpr auto StellaBindFields(const TYPE *) { \
+    return ::std::make_tuple(STELLA_BIND_FOR_EACH(STELLA_BIND_FIELD_AS, TYPE, __VA_ARGS__)); \
+  }
+
+#define STELLA_BIND_FIELD(TYPE, MEMBER) ::stella::bind::Field<TYPE, decltype(TYPE::MEMBER)>{#MEMBER, &TYPE::MEMBER}
+#define STELLA_BIND_FIELD_AS(TYPE, PAIR) STELLA_BIND_FIELD_AS_I(TYPE, STELLA_BIND_EXPAND(STELLA_BIND_UNPAIR PAIR))
+#define STELLA_BIND_FIELD_AS_I(TYPE, ...) STELLA_BIND_EXPAND(STELLA_BIND_FIELD_AS_II(TYPE, __VA_ARGS__))
+#define STELLA_BIND_FIELD_AS_II(TYPE, MEMBER, NAME) \
+  ::stella::bind::Field<TYPE, decltype(TYPE::MEMBER)>{NAME, &TYPE::MEMBER}
+#define STELLA_BIND_UNPAIR(MEMBER, NAME) MEMBER, NAME
+
+#define STELLA_BIND_EXPAND(X) X
+#define STELLA_BIND_PICK(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, NAME, ...) NAME
+#define STELLA_BIND_FOR_EACH(WHAT, TYPE, ...) \
+  STELLA_BIND_EXPAND(STELLA_BIND_PICK(__VA_ARGS__, STELLA_BIND_FE32, STELLA_BIND_FE31, STELLA_BIND_FE30, STELLA_BIND_FE29, STELLA_BIND_FE28, STELLA_BIND_FE27, STELLA_BIND_FE26, STELLA_BIND_FE25, STELLA_BIND_FE24, STELLA_BIND_FE23, STELLA_BIND_FE22, STELLA_BIND_FE21, STELLA_BIND_FE20, STELLA_BIND_FE19, STELLA_BIND_FE18, STELLA_BIND_FE17, STELLA_BIND_FE16, STELLA_BIND_FE15, STELLA_BIND_FE14, STELLA_BIND_FE13, STELLA_BIND_FE12, STELLA_BIND_FE11, STELLA_BIND_FE10, STELLA_BIND_FE9, STELLA_BIND_FE8, STELLA_BIND_FE7, STELLA_BIND_FE6, STELLA_BIND_FE5, STELLA_BIND_FE4, STELLA_BIND_FE3, STELLA_BIND_FE2, STELLA_BIND_FE1)(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE1(WHAT, TYPE, X) WHAT(TYPE, X)
+#define STELLA_BIND_FE2(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE1(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE3(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE2(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE4(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE3(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE5(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE4(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE6(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE5(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE7(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE6(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE8(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE7(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE9(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE8(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE10(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE9(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE11(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE10(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE12(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE11(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE13(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE12(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE14(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE13(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE15(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE14(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE16(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE15(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE17(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE16(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE18(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE17(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE19(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE18(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE20(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE19(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE21(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE20(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE22(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE21(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE23(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE22(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE24(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE23(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE25(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE24(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE26(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE25(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE27(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE26(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE28(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE27(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE29(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE28(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE30(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE29(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE31(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE30(WHAT, TYPE, __VA_ARGS__))
+#define STELLA_BIND_FE32(WHAT, TYPE, X, ...) WHAT(TYPE, X), STELLA_BIND_EXPAND(STELLA_BIND_FE31(WHAT, TYPE, __VA_ARGS__))
+
+namespace stella {
+
+namespace bind {
+
+template<typename T, typename M>
+struct Field {
+  ::std::string_view name_;
+  M T::*member_;
+};
+
+template<typename T, typename = void>
+struct is_bound : ::std::false_type {};
+
+template<typename T>
+struct is_bound<T, ::std::void_t<decltype(StellaBindFields(static_cast<const T *>(nullptr)))>> : ::std::true_type {};
+
+template<typename T>
+inline constexpr bool is_bound_v = is_bound<T>::value;
+
+struct Ops;
+
+/**
+ * @brief an object being filled and the operations of its type
+ */
+struct Target {
+  void *object_;
+  const Ops *ops_;
+
+  explicit operator bool() const { return object_ != nullptr; }
+};
+
+/**
+ * @brief type-erased operations, nullptr where the type does not accept the lua value
+ */
+struct Ops {
+  bool (*nil_)(void *object);
+  bool (*bool_)(void *object, bool b);
+  bool (*integer_)(void *object, LUA_INTEGER i);
+  bool (*number_)(void *object, LUA_NUMBER n);
+  bool (*string_)(void *object, ::std::string_view str);
+  Target (*open_)(void *object, ::std::size_t size);          // a table starts, returns what its keys fill,
+                                                              // a null target when it cannot hold a table
+  Target (*key_)(void *object, LUA_INTEGER key);              // the slot of a key, a null target skips it
+  Target (*name_)(void *object, ::std::string_view key);
+};
+
+template<typename T, typename = void>
+struct Traits {
+  static_assert(::std::is_void_v<T> && !::std::is_void_v<T>, "type not bindable, declare it with STELLA_BIND");
+};
+
+template<typename T>
+inline constexpr Target MakeTarget(T *object) { return {object, &Traits<T>::kOps}; }
+
+inline bool Keep(void *) { return true; }
+
+template<>
+struct Traits<bool> {
+  static bool Bool(void *object, bool b) { return *static_cast<bool *>(object) = b, true; }
+
+  static constexpr Ops kOps{Keep, Bool, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+};
+
+template<typename T>
+struct Traits<T, ::std::enable_if_t<::std::is_integral_v<T> && !::std::is_same_v<T, bool>>> {
+  static bool Integer(void *object, LUA_INTEGER i) {
+    if constexpr (::std::is_unsigned_v<T>) {
+      if (i < 0 || static_cast<::std::make_unsigned_t<LUA_INTEGER>>(i) > ::std::numeric_limits<T>::max()) {
+        return false;
+      }
+    } else {
+      if (i < ::std::numeric_limits<T>::min() || i > ::std::numeric_limits<T>::max()) { return false; }
+    }
+    *static_cast<T *>(object) = static_cast<T>(i);
+    return true;
+  }
+
+  /**
+   * @brief floats with an integral value, 3.0 but not 3.5, nan, the infinities and the values out
+   * of the range of an integer are rejected before the cast
+   */
+  static bool Number(void *object, LUA_NUMBER n) {
+    // 2^63 itself does not fit
+    constexpr auto kLimit = static_cast<LUA_NUMBER>(static_cast<LUA_NUMBER>(1ull << 62) * 2);
+    if (!(n >= -kLimit && n < kLimit) || ::std::floor(n) != n) { return false; }
+    return Integer(object, static_cast<LUA_INTEGER>(n));
+  }
+
+  static constexpr Ops kOps{Keep, nullptr, Integer, Number, nullptr, nullptr, nullptr, nullptr};
+};
+
+template<typename T>
+struct Traits<T, ::std::enable_if_t<::std::is_floating_point_v<T>>> {
+  static bool Integer(void *object, LUA_INTEGER i) { return *static_cast<T *>(object) = static_cast<T>(i), true; }
+  static bool Number(void *object, LUA_NUMBER n) { return *static_cast<T *>(object) = static_cast<T>(n), true; }
+
+  static constexpr Ops kOps{Keep, nullptr, Integer, Number, nullptr, nullptr, nullptr, nullptr};
+};
+
+template<>
+struct Traits<::std::string> {
+  static bool String(void *object, ::std::string_view str) {
+    static_cast<::std::string *>(object)->assign(str.data(), str.size());
+    return true;
+  }
+
+  static constexpr Ops kOps{Keep, nullptr, nullptr, nullptr, String, nullptr, nullptr, nullptr};
+};
+
+/**
+ * @brief binds a lua sequence, the elements arrive in order, an integer key past the next
+ * position of a table that is not a sequence is skipped
+ */
+template<typename T, typename Allocator>
+struct Traits<::std::vector<T, Allocator>> {
+  using Vector = ::std::vector<T, Allocator>;
+
+  static Target Open(void *object, ::std::size_t size) {
+    auto *vector = static_cast<Vector *>(object);
+    vector->clear();
+    vector->reserve(size);
+    return {object, &kOps};
+  }
+
+  static Target Key(void *object, LUA_INTEGER key) {
+    auto *vector = static_cast<Vector *>(object);
+    if (key < 1 || static_cast<::std::size_t>(key) > vector->size() + 1) { return {}; }
+    if (static_cast<::std::size_t>(key) == vector->size() + 1) { vector->emplace_back(); }
+    return MakeTarget(&(*vector)[static_cast<::std::size_t>(key - 1)]);
+  }
+
+  static constexpr Ops kOps{Keep, nullptr, nullptr, nullptr, nullptr, Open, Key, nullptr};
+};
+
+/**
+ * @brief nil resets the optional, any other value is bound to its content
+ */
+template<typename T>
+struct Traits<::std::optional<T>> {
+  template<auto Fn, typename... Args>
+  static auto Forward(void *object, Args... args) {
+    auto fn = Traits<T>::kOps.*Fn;
+    using Result = decltype(fn(object, args...));
+    if (fn == nullptr) { return Result{}; }
+    return fn(&static_cast<::std::optional<T> *>(object)->emplace(), args...);
+  }
+
+  static bool Nil(void *object) { return static_cast<::std::optional<T> *>(object)->reset(), true; }
+  static bool Bool(void *object, bool b) { return Forward<&Ops::bool_>(object, b); }
+  static bool Integer(void *object, LUA_INTEGER i) { return Forward<&Ops::integer_>(object, i); }
+  static bool Number(void *object, LUA_NUMBER n) { return Forward<&Ops::number_>(object, n); }
+  static bool String(void *object, ::std::string_view str) { return Forward<&Ops::string_>(object, str); }
+  static Target Open(void *object, ::std::size_t size) { return Forward<&Ops::open_>(object, size); }
+
+  static constexpr Ops kOps{Nil, Bool, Integer, Number, String, Open, nullptr, nullptr};
+};
+
+/**
+ * @brief collision free hash of the field names, the seed is searched at compile time,
+ * a key is matched with one probe and one string comparison
+ */
+template<::std::size_t N>
+struct PerfectHash {
+  static constexpr ::std::size_t kCapacity = [] {
+    ::std::size_t capacity = 1;
+    while (capacity < N * 4) { capacity <<= 1; }
+    return capacity;
+  }();
+
+  ::std::uint32_t seed_ = 0;
+  bool found_ = false;
+  ::std::array<::std::uint8_t, kCapacity> slots_{}; // field index + 1, 0 for an empty slot
+
+  static constexpr ::std::uint32_t Hash(::std::string_view key, ::std::uint32_t seed) {
+    // 32-bit FNV-1a, the seed perturbs the offset basis
+    ::std::uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (auto c : key) {
+      h ^= static_cast<unsigned char>(c);
+      h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+  }
+
+  static constexpr PerfectHash Build(const ::std::array<::std::string_view, N> &names) {
+    PerfectHash hash;
+    for (::std::uint32_t seed = 0; seed < (1u << 16); ++seed) {
+      ::std::array<::std::uint8_t, kCapacity> slots{};
+      bool collision = false;
+      for (::std::size_t i = 0; i < N && !collision; ++i) {
+        auto &slot = slots[Hash(names[i], seed) & (kCapacity - 1)];
+        collision = slot != 0;
+        slot = static_cast<::std::uint8_t>(i + 1);
+      }
+      if (!collision) {
+        hash.seed_ = seed;
+        hash.found_ = true;
+        hash.slots_ = slots;
+        return hash;
+      }
+    }
+    return hash;
+  }
+
+  /**
+   * @return the field index, N when the key is not a field
+   */
+  [[nodiscard]] constexpr ::std::size_t Find(const ::std::array<::std::string_view, N> &names,
+                                             ::std::string_view key) const {
+    auto slot = slots_[Hash(key, seed_) & (kCapacity - 1)];
+    if (slot == 0 || names[slot - 1] != key) { return N; }
+    return slot - 1u;
+  }
+};
+
+template<typename T>
+struct Traits<T, ::std::enable_if_t<is_bound_v<T>>> {
+  static constexpr auto kFields = StellaBindFields(static_cast<const T *>(nullptr));
+  static constexpr ::std::size_t N = ::std::tuple_size_v<decltype(kFields)>;
+
+  static_assert(N < 256, "too many fields");
+
+  template<::std::size_t... Is>
+  static constexpr ::std::array<::std::string_view, N> Names(::std::index_sequence<Is...>) {
+    return {::std::get<Is>(kFields).name_...};
+  }
+
+  static constexpr ::std::array<::std::string_view, N> kNames = Names(::std::make_index_sequence<N>());
+  static constexpr PerfectHash<N> kHash = PerfectHash<N>::Build(kNames);
+
+  static_assert(kHash.found_, "no perfect hash for the field names, are they unique?");
+
+  template<::std::size_t I>
+  static Target Get(void *object) {
+    return MakeTarget(&(static_cast<T *>(object)->*::std::get<I>(kFields).member_));
+  }
+
+  template<::std::size_t... Is>
+  static constexpr ::std::array<Target (*)(void *), N> Getters(::std::index_sequence<Is...>) {
+    return {&Get<Is>...};
+  }
+
+  static constexpr ::std::array<Target (*)(void *), N> kGetters = Getters(::std::make_index_sequence<N>());
+
+  static Target Open(void *object, ::std::size_t size) {
+    (void) size;
+    return {object, &kOps};
+  }
+
+  static Target Name(void *object, ::std::string_view key) {
+    auto i = kHash.Find(kNames, key);
+    if (i == N) { return {}; }
+    return kGetters[i](object);
+  }
+
+  static constexpr Ops kOps{Keep, nullptr, nullptr, nullptr, nullptr, Open, nullptr, Name};
+};
+
+/**
+ * @brief handler filling an object straight from the Reader or Value::WriteTo, without building
+ * values, keys that are not fields are skipped along with their subtrees, a lua value the field
+ * type does not accept stops the walk
+ */
+class Handler {
+ private:
+  struct Frame {
+    Target target_;
+    LUA_INTEGER index_; // last position of a sequence, -1 for a table
+  };
+
+  Target root_;
+  Target pending_;          // slot of the last key, a null target when the key is skipped
+  ::std::vector<Frame> stack_;
+  bool mismatch_ = false;
+
+ public:
+  template<typename T>
+  explicit Handler(T *object) : root_(MakeTarget(object)), pending_(root_) {}
+
+  /**
+   * @brief whether the walk stopped on a value of the wrong type
+   */
+  [[nodiscard]] bool Mismatch() const { return mismatch_; }
+
+  bool Nil() { return Scalar(&Ops::nil_); }
+  bool Bool(bool b) { return Scalar(&Ops::bool_, b); }
+  bool Integer(LUA_INTEGER i) { return Scalar(&Ops::integer_, i); }
+  bool Number(LUA_NUMBER n) { return Scalar(&Ops::number_, n); }
+  bool String(::std::string_view str) { return Scalar(&Ops::string_, str); }
+
+  bool Key(LUA_INTEGER i) {
+    auto &top = stack_.back().target_;
+    pending_ = top.ops_->key_ != nullptr ? top.ops_->key_(top.object_, i) : Target{};
+    return true;
+  }
+
+  bool Key(::std::string_view str) {
+    auto &top = stack_.back().target_;
+    pending_ = top.ops_->name_ != nullptr ? top.ops_->name_(top.object_, str) : Target{};
+    return true;
+  }
+
+  handler::Visit StartTable() { return Open(0, -1); }
+  bool EndTable() { return stack_.pop_back(), true; }
+  handler::Visit StartArray(::std::size_t length) { return Open(length, 0); }
+  bool EndArray() { return stack_.pop_back(), true; }
+
+ private:
+  /**
+   * @brief the slot of the next value, in a sequence it is the next position
+   */
+  Target Next() {
+    if (!stack_.empty() && stack_.back().index_ >= 0) {
+      auto &top = stack_.back();
+      ++top.index_;
+      return top.target_.ops_->key_ != nullptr ? top.target_.ops_->key_(top.target_.object_, top.index_) : Target{};
+    }
+    return ::std::exchange(pending_, Target{});
+  }
+
+  template<typename Fn, typename... Args>
+  bool Scalar(Fn Ops::*fn, Args... args) {
+    auto target = Next();
+    if (!target) { return true; }
+    if (target.ops_->*fn == nullptr || !(target.ops_->*fn)(target.object_, args...)) {
+      mismatch_ = true;
+      return false;
+    }
+    return true;
+  }
+
+  handler::Visit Open(::std::size_t size, LUA_INTEGER index) {
+    auto target = Next();
+    if (!target) { return handler::Visit::kSkip; }
+    auto opened = target.ops_->open_ != nullptr ? target.ops_->open_(target.object_, size) : Target{};
+    if (!opened) {
+      mismatch_ = true;
+      return handler::Visit::kStop;
+    }
+    stack_.push_back(Frame{opened, index});
+    return handler::Visit::kContinue;
+  }
+};
+
+} // namespace bind
+
+/**
+ * @brief fills object from the value on the top of the stack and pops it, the fields
+ * absent from lua keep their value
+ * @return TYPE_MISMATCH when a lua value does not fit its field
+ */
+template<typename T>
+inline error::ParseError Bind(State &state, T *object) {
+  bind::Handler handler(object);
+  auto err = Reader::Parse(state, handler);
+  return err == error::USER_STOPPED && handler.Mismatch() ? error::TYPE_MISMATCH : err;
+}
+
+template<typename T>
+inline error::ParseError Bind(State &state, ::std::string_view name, T *object) {
+  state.GetGlobal(name);
+  return Bind(state, object);
+}
+
+/**
+ * @brief same as above from a value, e.g. a Document or a SnapshotView
+ */
+template<typename T, typename Source>
+inline error::ParseError BindValue(const Source &value, T *object) {
+  bind::Handler handler(object);
+  if (value.WriteTo(handler)) { return error::OK; }
+  return handler.Mismatch() ? error::TYPE_MISMATCH : error::USER_STOPPED;
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_BIND_H_
@@ -0,0 +1,222 @@
+//
+// Created by Homin Su on 2023/6/17.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_CHUNK_CACHE_H_
+#define STELLA_INCLUDE_STELLA_CHUNK_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "non_copyable.h"
+
+#include <lua.hpp>
+
+namespace stella {
+
+/**
+ * @brief identifies a compiled chunk by the content of its source and the lua build that compiled it,
+ * editing the source or upgrading lua gives a different key, so stale chunks are never looked up
+ */
+struct ChunkKey {
+  ::std::uint64_t hash_;
+  ::std::uint64_t size_;
+  ::std::uint32_t version_;
+
+  static ChunkKey Of(::std::string_view source);
+
+  /**
+   * @brief FNV-1a 64 of bytes
+   */
+  static ::std::uint64_t Hash(::std::string_view bytes);
+
+  bool operator==(const ChunkKey &rhs) const {
+    return hash_ == rhs.hash_ && size_ == rhs.size_ && version_ == rhs.version_;
+  }
+};
+
+/**
+ * @brief storage of lua_dump output used by State::Load, a chunk that fails to load is recompiled
+ * from the source and stored again
+ */
+class ChunkCache : NonCopyable {
+ public:
+  virtual ~ChunkCache() = default;
+
+  /**
+   * @return the compiled chunk, nullptr on a miss
+   */
+  virtual ::std::shared_ptr<const ::std::string> Get(const ChunkKey &key) = 0;
+  virtual void Put(const ChunkKey &key, ::std::string chunk) = 0;
+};
+
+/**
+ * @brief process wide cache, states sharing it compile a script once
+ */
+class MemoryChunkCache : public ChunkCache {
+ private:
+  struct KeyHash {
+    ::std::size_t operator()(const ChunkKey &key) const { return static_cast<::std::size_t>(key.hash_); }
+  };
+
+  ::std::mutex mutex_;
+  ::std::unordered_map<ChunkKey, ::std::shared_ptr<const ::std::string>, KeyHash> chunks_;
+
+ public:
+  ::std::shared_ptr<const ::std::string> Get(const ChunkKey &key) override;
+  void Put(const ChunkKey &key, ::std::string chunk) override;
+
+  void Clear();
+};
+
+/**
+ * @brief on-disk cache, one file per chunk under a directory that must exist, files are written
+ * to a temporary name unique to the process and the thread and renamed so readers never see a
+ * partial chunk, the directory may be shared by several processes. A file that does not hold the
+ * chunk its header announces is a miss, and so is a chunk whose checksum does not match, lua loads
+ * binary chunks without verifying them
+ */
+class FileChunkCache : public ChunkCache {
+ private:
+  struct Header {
+    char magic_[4];
+    ::std::uint32_t version_;
+    ::std::uint64_t hash_;
+    ::std::uint64_t size_;
+    ::std::uint64_t chunk_size_;
+    ::std::uint64_t checksum_;  // ChunkKey::Hash of the chunk
+  };
+
+  static constexpr char kMagic[4] = {'S', 'T', 'L', '2'};
+
+  ::std::string directory_;
+
+ public:
+  explicit FileChunkCache(::std::string directory) : directory_(::std::move(directory)) {}
+
+  ::std::shared_ptr<const ::std::string> Get(const ChunkKey &key) override;
+  void Put(const ChunkKey &key, ::std::string chunk) override;
+
+  /**
+   * @brief suffix of a temporary file unique to the process and the thread writing it
+   */
+  static ::std::string TempSuffix();
+
+ private:
+  [[nodiscard]] ::std::string PathOf(const ChunkKey &key) const;
+};
+
+inline ChunkKey ChunkKey::Of(::std::string_view source) {
+  auto hash = Hash(source);
+  // binary chunks also depend on the width of the numeric types
+  auto version = static_cast<::std::uint32_t>(LUA_VERSION_NUM) << 8
+      | static_cast<::std::uint32_t>(sizeof(LUA_INTEGER)) << 4
+      | static_cast<::std::uint32_t>(sizeof(LUA_NUMBER));
+  return {hash, source.size(), version};
+}
+
+inline ::std::uint64_t ChunkKey::Hash(::std::string_view bytes) {
+  ::std::uint64_t hash = 14695981039346656037ull;
+  for (auto c : bytes) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+inline ::std::shared_ptr<const ::std::string> MemoryChunkCache::Get(const ChunkKey &key) {
+  ::std::lock_guard<::std::mutex> lock(mutex_);
+  if (auto it = chunks_.find(key); it != chunks_.end()) { return it->second; }
+  return nullptr;
+}
+
+inline void MemoryChunkCache::Put(const ChunkKey &key, ::std::string chunk) {
+  auto ptr = ::std::make_shared<const ::std::string>(::std::move(chunk));
+  ::std::lock_guard<::std::mutex> lock(mutex_);
+  chunks_[key] = ::std::move(ptr);
+}
+
+inline void MemoryChunkCache::Clear() {
+  ::std::lock_guard<::std::mutex> lock(mutex_);
+  chunks_.clear();
+}
+
+inline ::std::shared_ptr<const ::std::string> FileChunkCache::Get(const ChunkKey &key) {
+  FILE *fp = fopen(PathOf(key).c_str(), "rb");
+  if (fp == nullptr) { return nullptr; }
+
+  // the size announced is checked against the file before anything is allocated for it
+  long file_size = -1;
+  if (fseek(fp, 0, SEEK_END) == 0) { file_size = ftell(fp); }
+  ::std::shared_ptr<::std::string> chunk;
+  Header header{};
+  if (file_size >= static_cast<long>(sizeof(header)) && fseek(fp, 0, SEEK_SET) == 0
+      && fread(&header, sizeof(header), 1, fp) == 1
+      && ::std::memcmp(header.magic_, kMagic, sizeof(kMagic)) == 0
+      && header.version_ == key.version_ && header.hash_ == key.hash_ && header.size_ == key.size_
+      && header.chunk_size_ == static_cast<::std::uint64_t>(file_size) - sizeof(header)) {
+    chunk = ::std::make_shared<::std::string>(header.chunk_size_, '\0');
+    if (fread(chunk->data(), 1, chunk->size(), fp) != chunk->size() || ChunkKey::Hash(*chunk) != header.checksum_) {
+      chunk.reset();
+    }
+  }
+  fclose(fp);
+  return chunk;
+}
+
+inline void FileChunkCache::Put(const ChunkKey &key, ::std::string chunk) {
+  auto path = PathOf(key);
+  auto tmp = path + TempSuffix();
+
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (fp == nullptr) { return; }
+
+  Header header{};
+  ::std::memcpy(header.magic_, kMagic, sizeof(kMagic));
+  header.version_ = key.version_;
+  header.hash_ = key.hash_;
+  header.size_ = key.size_;
+  header.chunk_size_ = chunk.size();
+  header.checksum_ = ChunkKey::Hash(chunk);
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(chunk.data(), 1, chunk.size(), fp) == chunk.size();
+  ok = fclose(fp) == 0 && ok;
+
+  if (!ok || ::std::rename(tmp.c_str(), path.c_str()) != 0) { ::std::remove(tmp.c_str()); }
+}
+
+inline ::std::string FileChunkCache::PathOf(const ChunkKey &key) const {
+  char name[48];
+  snprintf(name, sizeof(name), "/%016llx-%x.luac", static_cast<unsigned long long>(key.hash_), key.version_);
+  return directory_ + name;
+}
+
+inline ::std::string FileChunkCache::TempSuffix() {
+#if defined(_WIN32)
+  auto pid = static_cast<long long>(_getpid());
+#else
+  auto pid = static_cast<long long>(getpid());
+#endif
+  return ".tmp" + ::std::to_string(pid) + "-"
+      + ::std::to_string(::std::hash<::std::thread::id>()(::std::this_thread::get_id()));
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_CHUNK_CACHE_H_
@@ -0,0 +1,362 @@
+//
+// Created by Homin Su on 2023/6/21.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_CONFIG_HANDLE_H_
+#define STELLA_INCLUDE_STELLA_CONFIG_HANDLE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <filesystem>
+#include <system_error>
+#endif
+
+#include "document.h"
+#include "exception.h"
+#include "lua_allocator.h"
+#include "non_copyable.h"
+#include "profiler.h"
+#include "reader.h"
+#include "state.h"
+#include "stella.h"
+
+namespace stella {
+
+/**
+ * @brief a config document reloaded in the background and published read-copy-update style,
+ * readers never take a lock:
+ *
+ *   stella::ConfigHandle::Options options;
+ *   options.file_ = "app.lua";
+ *   options.name_ = "Application";
+ *   stella::ConfigHandle config(::std::move(options));
+ *   if (config.Start() != stella::error::OK) { ... }
+ *
+ *   auto guard = config.Read();   // wait-free
+ *   auto width = (*guard)["Width"].GetInteger();
+ *
+ * a reload opens a fresh state on a LuaAllocator, runs the file under the budget, parses the global
+ * named by the options, closes the state and swaps the document in, a failed reload keeps the published
+ * document. The budget keeps a looping or runaway script from stalling the reloading thread. The
+ * watcher reloads once the files stayed quiet for the debounce interval, it uses inotify on linux
+ * and compares modification times elsewhere.
+ *
+ * a document stays alive as long as a Guard on it, a reload waits for the guards taken before the
+ * swap to be released before freeing the old document, so a guard must be short-lived and must not
+ * be held by the thread that reloads.
+ */
+class ConfigHandle : NonCopyable {
+ public:
+  struct Options {
+    ::std::string file_;                        // entry script
+    ::std::string name_;                        // global parsed, required, _G holds the standard library
+    ::std::vector<::std::string> watch_;        // more files reloading the entry script, e.g. its modules
+    unsigned flags_ = kParseDefaultFlags;       // neither borrowed strings nor lazy tables, the state is closed
+    ::std::chrono::milliseconds debounce_{100}; // quiet time after a change before the reload
+    bool watch_files_ = true;                   // start the watcher, otherwise only Reload() swaps documents
+    ::std::function<void(error::ParseError)> on_reload_; // called on the reloading thread after every attempt
+    Profiler *profiler_ = nullptr;              // samples the script of every reload, read it from on_reload_
+    State::Budget budget_;                      // limits every run of the script, memory_ included
+  };
+
+ private:
+  struct alignas(64) Slot {
+    ::std::atomic<::std::size_t> readers_[2];
+  };
+
+ public:
+  class Guard : NonCopyable {
+   private:
+    friend class ConfigHandle;
+
+    ::std::atomic<::std::size_t> *readers_ = nullptr;
+    const Document *document_ = nullptr;
+
+    Guard(::std::atomic<::std::size_t> *readers, const Document *document)
+        : readers_(readers), document_(document) {}
+
+   public:
+    Guard(Guard &&other) noexcept
+        : readers_(::std::exchange(other.readers_, nullptr)), document_(::std::exchange(other.document_, nullptr)) {}
+    ~Guard() { if (readers_ != nullptr) { readers_->fetch_sub(1, ::std::memory_order_release); }}
+
+    const Document &operator*() const { return *document_; }
+    const Document *operator->() const { return document_; }
+  };
+
+  explicit ConfigHandle(Options options);
+  ~ConfigHandle();
+
+  /**
+   * @brief loads the first document and starts the watcher, the watcher is started on failure too,
+   * so fixing the file brings the config up, readers see an empty document until then
+   */
+  error::ParseError Start();
+  void Stop();
+
+  /**
+   * @brief the current document, pinned until the guard dies
+   */
+  [[nodiscard]] Guard Read() const;
+
+  /**
+   * @brief reloads now on the calling thread, concurrent reloads run one after another
+   * @return BAD_KEY without a name, OPEN_FAILED when the file cannot be read
+   */
+  error::ParseError Reload();
+
+  /**
+   * @brief number of documents published so far
+   */
+  [[nodiscard]] ::std::uint64_t Version() const { return version_.load(::std::memory_order_acquire); }
+
+ private:
+  Options options_;
+  ::std::size_t num_slots_;
+  ::std::unique_ptr<Slot[]> slots_;
+  ::std::atomic<const Document *> current_;
+  ::std::atomic<::std::size_t> phase_{0};
+  ::std::atomic<::std::uint64_t> version_{0};
+  ::std::mutex reload_mutex_;
+  ::std::thread watcher_;
+  ::std::atomic<bool> stop_{false};
+#if defined(__linux__)
+  int wake_[2] = {-1, -1};
+#else
+  ::std::mutex wait_mutex_;
+  ::std::condition_variable wake_;
+#endif
+
+  [[nodiscard]] ::std::size_t HomeSlot() const;
+  void Publish(::std::unique_ptr<Document> document);
+  void Synchronize();
+  void Watch();
+};
+
+inline ConfigHandle::ConfigHandle(Options options)
+    : options_(::std::move(options)),
+      num_slots_(::std::max(1u, ::std::thread::hardware_concurrency())),
+      slots_(::std::make_unique<Slot[]>(num_slots_)),
+      current_(new Document()) {
+  STELLA_ASSERT(!(options_.flags_ & (kParseBorrowStringsFlag | kParseLazyFlag)) && "the state is closed");
+  STELLA_ASSERT(!options_.name_.empty() && "no global to parse");
+  for (::std::size_t i = 0; i < num_slots_; ++i) {
+    slots_[i].readers_[0].store(0, ::std::memory_order_relaxed);
+    slots_[i].readers_[1].store(0, ::std::memory_order_relaxed);
+  }
+}
+
+inline ConfigHandle::~ConfigHandle() {
+  Stop();
+  delete current_.load(::std::memory_order_acquire);
+}
+
+inline error::ParseError ConfigHandle::Start() {
+  auto err = Reload();
+  if (options_.watch_files_ && !watcher_.joinable()) {
+    stop_.store(false, ::std::memory_order_relaxed);
+#if defined(__linux__)
+    if (::pipe2(wake_, O_CLOEXEC) != 0) { return err; }
+#endif
+    watcher_ = ::std::thread([this] { Watch(); });
+  }
+  return err;
+}
+
+inline void ConfigHandle::Stop() {
+  if (!watcher_.joinable()) { return; }
+  stop_.store(true, ::std::memory_order_relaxed);
+#if defined(__linux__)
+  char byte = 0;
+  while (::write(wake_[1], &byte, 1) < 0 && errno == EINTR) {}
+#else
+  {
+    ::std::lock_guard<::std::mutex> lock(wait_mutex_);
+    wake_.notify_all();
+  }
+#endif
+  watcher_.join();
+#if defined(__linux__)
+  ::close(wake_[0]);
+  ::close(wake_[1]);
+  wake_[0] = wake_[1] = -1;
+#endif
+}
+
+/**
+ * @brief the reader count goes up before the document is loaded, so a reload swapping the document
+ * afterwards waits for it, the slots are spread over the threads to keep the counters uncontended
+ */
+inline ConfigHandle::Guard ConfigHandle::Read() const {
+  auto &slot = slots_[HomeSlot()];
+  auto *readers = &slot.readers_[phase_.load(::std::memory_order_seq_cst) & 1];
+  readers->fetch_add(1, ::std::memory_order_seq_cst);
+  return {readers, current_.load(::std::memory_order_seq_cst)};
+}
+
+inline error::ParseError ConfigHandle::Reload() {
+  ::std::lock_guard<::std::mutex> lock(reload_mutex_);
+
+  ::std::string script;
+  LuaAllocator allocator;
+  State state;
+  auto document = ::std::make_unique<Document>();
+  auto err = error::OK;
+  if (options_.name_.empty()) {
+    err = error::BAD_KEY;
+  } else if (!State::ReadFile(options_.file_, &script) || !state.Open(LuaAllocator::Alloc, &allocator)) {
+    err = error::OPEN_FAILED;
+  } else {
+    if (options_.profiler_ != nullptr) { options_.profiler_->Start(state); }
+    err = state.Load(script, "@" + options_.file_) ? state.Call(options_.budget_) : error::CALL_FAILED;
+    if (options_.profiler_ != nullptr) { options_.profiler_->Stop(state); }
+    if (err == error::OK) { err = document->Parse(state, options_.name_, options_.flags_); }
+    state.Destroy();
+  }
+
+  if (err == error::OK) { Publish(::std::move(document)); }
+  if (options_.on_reload_) { options_.on_reload_(err); }
+  return err;
+}
+
+inline ::std::size_t ConfigHandle::HomeSlot() const {
+  static ::std::atomic<::std::size_t> next{0};
+  thread_local ::std::size_t index = next.fetch_add(1, ::std::memory_order_relaxed);
+  return index % num_slots_;
+}
+
+inline void ConfigHandle::Publish(::std::unique_ptr<Document> document) {
+  const auto *old = current_.exchange(document.release(), ::std::memory_order_seq_cst);
+  version_.fetch_add(1, ::std::memory_order_release);
+  Synchronize();
+  delete old;
+}
+
+/**
+ * @brief waits for every guard that may hold the old document, a reader counts itself in the phase
+ * it saw before loading the document, so a reader delayed between the two steps may count in a
+ * phase that was already drained, flipping twice waits for both phases and catches it
+ */
+inline void ConfigHandle::Synchronize() {
+  for (int flip = 0; flip < 2; ++flip) {
+    auto phase = phase_.fetch_add(1, ::std::memory_order_seq_cst) & 1;
+    for (::std::size_t i = 0; i < num_slots_; ++i) {
+      while (slots_[i].readers_[phase].load(::std::memory_order_seq_cst) != 0) { ::std::this_thread::yield(); }
+    }
+  }
+}
+
+#if defined(__linux__)
+
+/**
+ * @brief watches the directories of the files, editors often replace a file by renaming a new one
+ * over it, which a watch on the file itself would miss
+ */
+inline void ConfigHandle::Watch() {
+  int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) { return; }
+
+  struct Target {
+    int wd_;
+    ::std::string name_;
+  };
+  ::std::vector<Target> targets;
+  auto add = [&](const ::std::string &path) {
+    auto slash = path.rfind('/');
+    auto dir = slash == ::std::string::npos ? ::std::string(".") : path.substr(0, slash == 0 ? 1 : slash);
+    auto name = slash == ::std::string::npos ? path : path.substr(slash + 1);
+    int wd = ::inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    if (wd >= 0) { targets.push_back(Target{wd, ::std::move(name)}); }
+  };
+  add(options_.file_);
+  for (const auto &path : options_.watch_) { add(path); }
+
+  alignas(struct inotify_event) char buffer[4096];
+  bool pending = false;
+  while (!stop_.load(::std::memory_order_relaxed)) {
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {wake_[0], POLLIN, 0}};
+    int n = ::poll(fds, 2, pending ? static_cast<int>(options_.debounce_.count()) : -1);
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      break;
+    }
+    if (fds[1].revents != 0) { break; }
+    if (n == 0) {
+      // quiet for the whole interval
+      pending = false;
+      Reload();
+      continue;
+    }
+
+    ::ssize_t size;
+    while ((size = ::read(fd, buffer, sizeof(buffer))) > 0) {
+      for (char *ptr = buffer; ptr < buffer + size;) {
+        const auto *event = reinterpret_cast<const struct inotify_event *>(ptr);
+        ptr += sizeof(struct inotify_event) + event->len;
+        if (event->len == 0) { continue; }
+        for (const auto &target : targets) {
+          if (target.wd_ == event->wd && target.name_ == event->name) { pending = true; }
+        }
+      }
+    }
+  }
+  ::close(fd);
+}
+
+#else
+
+inline void ConfigHandle::Watch() {
+  auto stamp = [this] {
+    ::std::vector<::std::filesystem::file_time_type> times;
+    ::std::error_code ec;
+    times.push_back(::std::filesystem::last_write_time(options_.file_, ec));
+    for (const auto &path : options_.watch_) { times.push_back(::std::filesystem::last_write_time(path, ec)); }
+    return times;
+  };
+
+  auto last = stamp();
+  bool pending = false;
+  ::std::unique_lock<::std::mutex> lock(wait_mutex_);
+  while (!stop_.load(::std::memory_order_relaxed)) {
+    wake_.wait_for(lock, options_.debounce_);
+    if (stop_.load(::std::memory_order_relaxed)) { break; }
+    auto now = stamp();
+    if (now != last) {
+      last = ::std::move(now);
+      pending = true;
+    } else if (pending) {
+      // unchanged for a whole interval
+      pending = false;
+      lock.unlock();
+      Reload();
+      lock.lock();
+    }
+  }
+}
+
+#endif
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_CONFIG_HANDLE_H_
@@ -6,11 +6,21 @@
 #define STELLA_INCLUDE_STELLA_DOCUMENT_H_
 
 #include <cstddef>
+#include <cstring>
 
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "allocator.h"
 #include "exception.h"
+#include "non_copyable.h"
+#include "parse_stats.h"
+#include "projection.h"
 #include "reader.h"
 #include "stella.h"
 #include "stella/state.h"
@@ -24,6 +34,20 @@ STELLA_DIAG_OFF(effc++)
 
 namespace stella {
 
+/**
+ * @brief one entry of the change set filled by Document::Refresh, the path holds the keys from
+ * the root, integers for positions in a sequence, a changed subtree is reported once at its root,
+ * the keys own their strings
+ */
+struct Change {
+  enum Kind { kAdded, kRemoved, kModified };
+
+  Kind kind_;
+  ::std::vector<Value> path_;
+};
+
+using ChangeSet = ::std::vector<Change>;
+
 class Document : public Value {
  private:
   struct Level {
@@ -32,17 +56,115 @@ class Document : public Value {
 
     explicit Level(Value *value) : value_(value), value_count_(0) {}
 
-    [[nodiscard]] Type type() const { return value_->type_; }
+    [[nodiscard]] Type type() const { return value_->GetType(); }
     [[nodiscard]] Value *last_value() const;
   };
 
+  ::std::unique_ptr<MemoryPoolAllocator> own_allocator_;
+  MemoryPoolAllocator *allocator_;
   ::std::vector<Level> stack_;
   Value key_;
   bool see_value_ = false;
+  bool borrow_strings_ = false;
+  bool intern_keys_ = false;
+  bool intern_strings_ = false;
+  ::std::unique_ptr<::std::unordered_set<::std::string_view>> own_symbols_;
+  ::std::unordered_set<::std::string_view> *symbols_ = nullptr; // shared with the sub documents of Refresh
+  State pinned_state_;
+  int pinned_ref_ = LUA_NOREF;
+
+  struct DiffLevel {
+    Value *value_;
+    ::std::size_t pos_;          // position of the value in the level above
+    LUA_INTEGER index_;
+    LUA_INTEGER length_;         // length of a sequence, -1 for a table
+    ::std::vector<bool> seen_;   // members of a table still present in the lua table
+  };
 
  public:
-  error::ParseError Parse(State &state, ::std::string_view name);
-  error::ParseError ParseState(State &state);
+  static constexpr ::std::size_t kInternMaxLength = 64; // longest string value kParseInternStringsFlag interns
+
+  /**
+   * @param allocator pool every string and table of the document is drawn from,
+   * a private one is created when it is nullptr, a shared one must outlive the document
+   */
+  explicit Document(MemoryPoolAllocator *allocator = nullptr);
+  Document(Document &&other) noexcept;
+  ~Document();
+
+  MemoryPoolAllocator &GetAllocator() { return *allocator_; }
+
+  /**
+   * @brief with kParseBorrowStringsFlag the strings point into the lua strings, the parsed table is
+   * pinned in the registry until the document dies, so the document must die before the state.
+   *
+   * with kParseLazyFlag every table starts as a registry reference to the lua table and is converted
+   * on first access, one level at a time, sequences are tables with integer keys 1..n and entries
+   * the reader would reject are left out. A lazy document must be materialized or die before the state.
+   *
+   * with kParseInternKeysFlag the string keys go through a symbol table of the document, the keys repeated
+   * across the records of an array share one copy and a lookup by a Symbol from Intern matches them by
+   * pointer, kParseInternStringsFlag does the same for string values up to kInternMaxLength bytes.
+   * Strings short enough to be stored in the value are left out, they take no storage of their own.
+   * Both are ignored when the strings are borrowed, lua interns its short strings already, and by the
+   * tables of a lazy parse.
+   */
+  error::ParseError Parse(State &state, ::std::string_view name, unsigned flags = kParseDefaultFlags);
+  error::ParseError ParseState(State &state, unsigned flags = kParseDefaultFlags);
+
+  /**
+   * @brief converts only the paths of the projection, the paths of ParseState start with the name of a global
+   */
+  error::ParseError Parse(State &state, ::std::string_view name, const Projection &projection,
+                          unsigned flags = kParseDefaultFlags);
+  error::ParseError ParseState(State &state, const Projection &projection, unsigned flags = kParseDefaultFlags);
+
+  /**
+   * @brief the same parse timed as the phase "Parse" of the stats and walked through a StatsHandler,
+   * the tables of a lazy parse are converted later and only the root is counted
+   */
+  error::ParseError Parse(State &state, ::std::string_view name, ParseStats &stats,
+                          unsigned flags = kParseDefaultFlags);
+  error::ParseError ParseState(State &state, ParseStats &stats, unsigned flags = kParseDefaultFlags);
+
+  /**
+   * @brief updates the document in place to the current lua value, subtrees whose contents are unchanged
+   * keep their storage and only the changed ones are rebuilt, the walk still visits every lua node but
+   * allocates in proportion to the change. The string mode of the last Parse is kept, borrowed strings
+   * are moved onto the new lua strings and the new value is pinned instead of the old one, so the state
+   * of the previous parse must still be alive.
+   *
+   * on error the changes made so far are kept, except with borrowed strings where the document is
+   * cleared, since it could point into both values. The whole lua value is compared, a projected
+   * document shows every key left out as added and a lazy document is materialized.
+   *
+   * the pool never frees, so the subtrees a refresh replaces stay in it until the document dies,
+   * a document refreshed for a long time should be compacted once the pool has grown well past
+   * the size it had after the last parse or compaction.
+   * @param changes filled with the added, removed and modified paths, may be nullptr
+   */
+  error::ParseError Refresh(State &state, ::std::string_view name, ChangeSet *changes = nullptr);
+  error::ParseError RefreshState(State &state, ChangeSet *changes = nullptr);
+
+  /**
+   * @brief converts every table a lazy parse left pending and releases their references,
+   * the document no longer needs the state afterwards unless its strings are borrowed
+   */
+  void Materialize();
+
+  /**
+   * @brief copies the tree into a fresh pool and drops the old one with everything Refresh left in it,
+   * the document owns its pool afterwards even if it was given one. Lazy tables are materialized,
+   * packed arrays stay packed and borrowed strings still point into lua. Iterators, references, symbols
+   * and versions shared out of the document are invalidated.
+   */
+  void Compact();
+
+  /**
+   * @brief the symbol of a key for FindMember and operator[], the bytes are added to the symbol table
+   * when missing, so the symbol stays valid as long as the document
+   */
+  Symbol Intern(::std::string_view str);
 
   // handler
   bool Nil();
@@ -53,26 +175,651 @@ class Document : public Value {
   bool Key(LUA_INTEGER i);
   bool Key(::std::string_view str);
   bool StartTable();
+  bool StartTable(::std::size_t narr, ::std::size_t nrec);
   bool EndTable();
+  bool StartArray(::std::size_t length);
+  bool EndArray();
 
  private:
+  class LazySource;
+
+  error::ParseError ParseLazy(State &state, unsigned flags);
+  error::ParseError ParseCounted(State &state, ParseStats &stats, unsigned flags);
+  void Pin(State &state, unsigned flags);
+  void Unpin();
   Value *AddValue(Value &&value);
+  Value MakeKey(::std::string_view str);
+  ::std::string_view Interned(::std::string_view str);
+  Value CopyNode(const Value &value);
+
+  error::ParseError Refresh(State &state, ChangeSet *changes);
+  error::ParseError Diff(State &state, ::std::vector<DiffLevel> &stack,
+                         ::std::vector<Value> &path, ChangeSet *changes);
+  error::ParseError DiffValue(State &state, Value *value, ::std::size_t pos, ::std::vector<DiffLevel> &stack,
+                              ::std::vector<Value> &path, ChangeSet *changes);
+  error::ParseError Build(State &state, Value *value, ::std::size_t depth);
+  void Own(::std::vector<DiffLevel> &stack);
+  Value *Own(::std::vector<DiffLevel> &stack, ::std::size_t pos);
+  static Value *Child(const DiffLevel &level, ::std::size_t pos);
+  static void Record(ChangeSet *changes, Change::Kind kind, const ::std::vector<Value> &path);
 };
 
 inline Value *Document::Level::last_value() const {
-  return &::std::get<S_TABLE>(value_->data_)->back().value_;
+  if (type() == S_ARRAY) { return &value_->data_.heap_.array_->back(); }
+  return &value_->data_.heap_.table_->back().value_;
+}
+
+inline Document::Document(MemoryPoolAllocator *allocator)
+    : Value(S_NIL),
+      own_allocator_(allocator == nullptr ? ::std::make_unique<MemoryPoolAllocator>() : nullptr),
+      allocator_(allocator == nullptr ? own_allocator_.get() : allocator),
+      stack_(),
+      key_(),
+      pinned_state_() {}
+
+inline Document::Document(Document &&other) noexcept
+    : Value(::std::move(other)),
+      own_allocator_(::std::move(other.own_allocator_)),
+      allocator_(other.allocator_),
+      stack_(::std::move(other.stack_)),
+      key_(::std::move(other.key_)),
+      see_value_(other.see_value_),
+      borrow_strings_(other.borrow_strings_),
+      intern_keys_(other.intern_keys_),
+      intern_strings_(other.intern_strings_),
+      own_symbols_(::std::move(other.own_symbols_)),
+      symbols_(::std::exchange(other.symbols_, nullptr)),
+      pinned_state_(other.pinned_state_),
+      pinned_ref_(::std::exchange(other.pinned_ref_, LUA_NOREF)) {}
+
+inline Document::~Document() {
+  // release the tree while the pool backing it is still alive
+  key_ = Value();
+  Release();
+  own_symbols_.reset();
+  Unpin();
+}
+
+/**
+ * @brief members of a lazy table, converted from the lua table held in the registry
+ */
+class Document::LazySource : public Table::Source {
+ private:
+  State state_;
+  int ref_;
+  MemoryPoolAllocator *allocator_;
+  unsigned flags_;
+  bool reserved_ = false;
+
+ public:
+  LazySource(State &state, int ref, MemoryPoolAllocator *allocator, unsigned flags)
+      : state_(state), ref_(ref), allocator_(allocator), flags_(flags) {}
+  ~LazySource() override { state_.Unref(ref_); }
+
+  void Load(Table &table) override;
+  bool Fetch(Table &table, LUA_INTEGER key) override;
+  bool Fetch(Table &table, ::std::string_view key) override;
+  [[nodiscard]] bool FetchesKeys() const override { return flags_ & kParseLazyKeysFlag; }
+
+  /**
+   * @brief converts the value at index, a table becomes a lazy table referencing it
+   * @return false for the values the reader rejects
+   */
+  static bool Convert(State &state, int index, MemoryPoolAllocator *allocator, unsigned flags, Value *value);
+
+ private:
+  /**
+   * @brief pops what a walk pushed on every exit, the allocations of a conversion may throw
+   */
+  class StackRestore : NonCopyable {
+   private:
+    State &state_;
+    ::std::size_t base_;
+
+   public:
+    explicit StackRestore(State &state) : state_(state), base_(state.StackSize()) {}
+    ~StackRestore() { state_.Pop(state_.StackSize() - base_); }
+  };
+
+  /**
+   * @brief the table is sized on the first fetch, so the members fetched one by one and the ones
+   * loaded later never move, references taken on a lazy document stay valid
+   */
+  template<typename Key>
+  bool FetchKey(Table &table, Key key) {
+    [[maybe_unused]] bool grown = state_.CheckStack(3);
+    STELLA_ASSERT(grown);
+    StackRestore restore(state_);
+    state_.PushRef(ref_);
+    if (!reserved_) {
+      Reader::TableSize size;
+      Reader::Measure(state_, 0, &size);
+      table.reserve(size.nrec_);
+      reserved_ = true;
+    }
+
+    state_.RawGet(-1, key);
+    Value value;
+    bool found = !state_.IsNil(-1) && Convert(state_, -1, allocator_, flags_, &value);
+    if (found) {
+      if constexpr (::std::is_same_v<Key, LUA_INTEGER>) { table.emplace_back(Value(key), ::std::move(value)); }
+      else { table.emplace_back(Value(key, *allocator_), ::std::move(value)); }
+    }
+    return found;
+  }
+};
+
+inline void Document::LazySource::Load(Table &table) {
+  [[maybe_unused]] bool grown = state_.CheckStack(3);
+  STELLA_ASSERT(grown);
+  StackRestore restore(state_);
+  state_.PushRef(ref_);
+  state_.Push(nullptr);
+  while (state_.HasNext(-2)) {
+    Value key;
+    if (LUA_INTEGER i; state_.Get(&i, -2)) {
+      if (table.find(i) == table.end()) { key = Value(i); }
+    } else if (::std::string_view str; state_.Get(&str, -2)) {
+      // fetched members are kept
+      if (table.find(str) == table.end()) {
+        key = flags_ & kParseBorrowStringsFlag ? Value(StringRef(str)) : Value(str, *allocator_);
+      }
+    }
+    if (Value value; !key.IsNil() && Convert(state_, -1, allocator_, flags_, &value)) {
+      table.emplace_back(::std::move(key), ::std::move(value));
+    }
+    state_.Pop();
+  }
+}
+
+inline bool Document::LazySource::Fetch(Table &table, LUA_INTEGER key) {
+  return FetchKey(table, key);
+}
+
+inline bool Document::LazySource::Fetch(Table &table, ::std::string_view key) {
+  return FetchKey(table, key);
+}
+
+inline bool Document::LazySource::Convert(State &state, int index, MemoryPoolAllocator *allocator,
+                                          unsigned flags, Value *value) {
+  // functions, userdata and threads are left out
+  Type type;
+  if (!state.GetType(&type, index)) { return false; }
+  switch (type) {
+    case S_BOOL: {
+      bool b = false;
+      state.Get(&b, index);
+      *value = Value(b);
+      return true;
+    }
+    case S_NUMBER: {
+      if (LUA_INTEGER i; state.Get(&i, index)) { *value = Value(i); }
+      else if (LUA_NUMBER n; state.Get(&n, index)) { *value = Value(n); }
+      return true;
+    }
+    case S_STRING: {
+      ::std::string_view str;
+      state.Get(&str, index);
+      *value = flags & kParseBorrowStringsFlag ? Value(StringRef(str)) : Value(str, *allocator);
+      return true;
+    }
+    case S_TABLE:
+      *value = Value::LazyTable(::std::make_unique<LazySource>(state, state.Ref(index), allocator, flags), *allocator);
+      return true;
+    default: return false;
+  }
 }
 
-inline error::ParseError Document::Parse(State &state, ::std::string_view name) {
+inline error::ParseError Document::Parse(State &state, ::std::string_view name, unsigned flags) {
   state.GetGlobal(name);
+  Pin(state, flags);
+  if (flags & kParseLazyFlag) { return ParseLazy(state, flags); }
   return Reader::Parse(state, *this);
 }
 
-inline error::ParseError Document::ParseState(State &state) {
+inline error::ParseError Document::ParseState(State &state, unsigned flags) {
   state.PushGlobalTable();
+  Pin(state, flags);
+  if (flags & kParseLazyFlag) { return ParseLazy(state, flags); }
   return Reader::Parse(state, *this);
 }
 
+inline error::ParseError Document::ParseLazy(State &state, unsigned flags) {
+  if (!state.IsTable(-1)) { return Reader::Parse(state, *this); }
+  STELLA_ASSERT(IsNil() && !see_value_);
+  Value value;
+  LazySource::Convert(state, -1, allocator_, flags, &value);
+  Value::operator=(::std::move(value));
+  see_value_ = true;
+  state.Pop();
+  return error::OK;
+}
+
+inline error::ParseError Document::Parse(State &state, ::std::string_view name, ParseStats &stats, unsigned flags) {
+  ParseStats::Scope scope(stats, "Parse");
+  state.GetGlobal(name);
+  return ParseCounted(state, stats, flags);
+}
+
+inline error::ParseError Document::ParseState(State &state, ParseStats &stats, unsigned flags) {
+  ParseStats::Scope scope(stats, "Parse");
+  state.PushGlobalTable();
+  return ParseCounted(state, stats, flags);
+}
+
+inline error::ParseError Document::ParseCounted(State &state, ParseStats &stats, unsigned flags) {
+  Pin(state, flags);
+  auto size = allocator_->Size();
+  auto capacity = allocator_->Capacity();
+  error::ParseError err;
+  if (flags & kParseLazyFlag && state.IsTable(-1)) {
+    err = ParseLazy(state, flags);
+    ++stats.tables_;
+    stats.max_depth_ = ::std::max(stats.max_depth_, ::std::size_t{1});
+  } else {
+    StatsHandler<Document> handler(*this, stats);
+    err = Reader::Parse(state, handler);
+  }
+  stats.pool_bytes_ += allocator_->Size() - size;
+  stats.chunk_bytes_ += allocator_->Capacity() - capacity;
+  return err;
+}
+
+inline error::ParseError Document::Parse(State &state, ::std::string_view name, const Projection &projection,
+                                         unsigned flags) {
+  state.GetGlobal(name);
+  Pin(state, flags);
+  return Reader::Parse(state, projection, *this);
+}
+
+inline error::ParseError Document::ParseState(State &state, const Projection &projection, unsigned flags) {
+  state.PushGlobalTable();
+  Pin(state, flags);
+  return Reader::Parse(state, projection, *this);
+}
+
+inline error::ParseError Document::Refresh(State &state, ::std::string_view name, ChangeSet *changes) {
+  state.GetGlobal(name);
+  return Refresh(state, changes);
+}
+
+inline error::ParseError Document::RefreshState(State &state, ChangeSet *changes) {
+  state.PushGlobalTable();
+  return Refresh(state, changes);
+}
+
+inline error::ParseError Document::Refresh(State &state, ChangeSet *changes) {
+  if (changes != nullptr) { changes->clear(); }
+
+  int ref = borrow_strings_ ? state.Ref(-1) : LUA_NOREF;
+  ::std::vector<DiffLevel> stack;
+  ::std::vector<Value> path;
+  auto err = Diff(state, stack, path, changes);
+
+  if (borrow_strings_) {
+    if (err != error::OK) {
+      state.Unref(ref);
+      ref = LUA_NOREF;
+      Value::operator=(Value());
+    }
+    Unpin();
+    pinned_state_ = state;
+    pinned_ref_ = ref;
+  }
+  return err;
+}
+
+/**
+ * @brief walks the value on the top of the stack against the document with an explicit stack like
+ * Reader::Parse, and pops it
+ */
+inline error::ParseError Document::Diff(State &state, ::std::vector<DiffLevel> &stack,
+                                        ::std::vector<Value> &path, ChangeSet *changes) {
+  auto base = state.StackSize() - 1;
+  auto err = DiffValue(state, this, 0, stack, path, changes);
+
+  while (err == error::OK && !stack.empty()) {
+    auto depth = stack.size();
+    auto &top = stack.back();
+
+    if (top.length_ >= 0) {
+      auto *array = top.value_->data_.heap_.array_;
+      if (top.index_ < top.length_) {
+        auto pos = static_cast<::std::size_t>(++top.index_);
+        state.RawGet(-1, top.index_);
+        path.emplace_back(top.index_);
+        if (pos <= array->size()) {
+          err = DiffValue(state, &(*array)[pos - 1], pos - 1, stack, path, changes);
+        } else if (Value value; (err = Build(state, &value, depth)) == error::OK) {
+          Record(changes, Change::kAdded, path);
+          Own(stack);
+          stack.back().value_->data_.heap_.array_->emplace_back(::std::move(value));
+        }
+        if (stack.size() == depth) { path.pop_back(); }
+        continue;
+      }
+
+      auto length = static_cast<::std::size_t>(top.length_);
+      for (auto pos = length + 1; pos <= array->size(); ++pos) {
+        path.emplace_back(static_cast<LUA_INTEGER>(pos));
+        Record(changes, Change::kRemoved, path);
+        path.pop_back();
+      }
+      if (array->size() > length) {
+        Own(stack);
+        array = top.value_->data_.heap_.array_;
+        array->erase(array->begin() + static_cast<Array::difference_type>(length), array->end());
+      }
+    } else {
+      auto *table = top.value_->data_.heap_.table_;
+      if (state.HasNext(-2)) {
+        LUA_INTEGER i = 0;
+        ::std::string_view str;
+        bool is_integer = state.Get(&i, -2);
+        if (!is_integer && !state.Get(&str, -2)) {
+          err = error::BAD_KEY;
+          break;
+        }
+
+        if (auto it = is_integer ? table->find(i) : table->find(str); it != table->end()) {
+          auto pos = static_cast<::std::size_t>(it - table->begin());
+          if (pos < top.seen_.size()) { top.seen_[pos] = true; }
+          if (it->key_.IsBorrowed()) {
+            Own(stack);
+            it = stack.back().value_->data_.heap_.table_->begin() + static_cast<Table::Members::difference_type>(pos);
+            it->key_.InitString(kBorrowedStringTag, str);
+          }
+          path.push_back(it->key_);
+          err = DiffValue(state, &it->value_, pos, stack, path, changes);
+          if (stack.size() == depth) { path.pop_back(); }
+        } else if (Value value; (err = Build(state, &value, depth)) == error::OK) {
+          Value key = is_integer ? Value(i) : MakeKey(str);
+          path.push_back(key);
+          Record(changes, Change::kAdded, path);
+          path.pop_back();
+          Own(stack);
+          stack.back().value_->data_.heap_.table_->emplace_back(::std::move(key), ::std::move(value));
+        }
+        continue;
+      }
+
+      auto &seen = top.seen_;
+      bool removed = false;
+      for (::std::size_t pos = 0; pos < seen.size(); ++pos) {
+        if (seen[pos]) { continue; }
+        removed = true;
+        path.push_back((table->begin() + static_cast<Table::Members::difference_type>(pos))->key_);
+        Record(changes, Change::kRemoved, path);
+        path.pop_back();
+      }
+      if (removed) {
+        Own(stack);
+        top.value_->data_.heap_.table_->retain([&seen](::std::size_t pos) { return pos >= seen.size() || seen[pos]; });
+      }
+    }
+
+    stack.pop_back();
+    state.Pop();
+    if (!stack.empty()) { path.pop_back(); }
+  }
+
+  if (err != error::OK) { state.Pop(state.StackSize() - base); }
+  return err;
+}
+
+/**
+ * @brief compares the value on the top of the stack with value, a table of the same kind is pushed
+ * on the stack to be walked, anything else is consumed and rebuilt if it differs
+ */
+inline error::ParseError Document::DiffValue(State &state, Value *value, ::std::size_t pos,
+                                             ::std::vector<DiffLevel> &stack,
+                                             ::std::vector<Value> &path, ChangeSet *changes) {
+  Type type;
+  if (!state.GetType(&type, -1)) { return error::BAD_VALUE; }
+
+  bool same = false;
+  switch (type) {
+    case S_NIL: same = value->IsNil();
+      break;
+    case S_BOOL:
+      if (bool b; state.Get(&b, -1)) { same = value->IsBool() && value->GetBool() == b; }
+      break;
+    case S_NUMBER:
+      if (LUA_INTEGER i; state.Get(&i, -1)) { same = value->IsInteger() && value->GetInteger() == i; }
+      else if (LUA_NUMBER n; state.Get(&n, -1) && value->IsNumber()) {
+        // bitwise, so that a NaN is not reported on every refresh
+        auto old = value->GetNumber();
+        same = ::std::memcmp(&old, &n, sizeof(n)) == 0;
+      }
+      break;
+    case S_STRING:
+      if (::std::string_view str; state.Get(&str, -1)) {
+        same = value->IsString() && value->GetStringView() == str;
+        if (same && value->IsBorrowed()) { Own(stack, pos)->InitString(kBorrowedStringTag, str); }
+      }
+      break;
+    case S_TABLE: {
+      if (stack.size() >= Reader::kDefaultMaxDepth) { return error::TOO_DEEP; }
+      if (!state.CheckStack(3)) { return error::STACK_OVERFLOW; }
+      // a packed sequence stays packed as long as lua holds only numbers there
+      if (value->IsNumbers()) {
+        if (Numbers numbers; state.GetNumbers(&numbers, -1) == error::OK) {
+          const auto &old = value->GetNumbers();
+          same = old.size() == numbers.size()
+              && (old.empty() || ::std::memcmp(old.data(), numbers.data(), old.size() * sizeof(LUA_NUMBER)) == 0);
+          if (!same) {
+            Own(stack, pos)->SetNumbers(::std::move(numbers));
+            state.Pop();
+            Record(changes, Change::kModified, path);
+            return error::OK;
+          }
+          break;
+        }
+      } else if (value->IsIntegers()) {
+        if (Integers integers; state.GetIntegers(&integers, -1) == error::OK) {
+          same = value->GetIntegers() == integers;
+          if (!same) {
+            Own(stack, pos)->SetIntegers(::std::move(integers));
+            state.Pop();
+            Record(changes, Change::kModified, path);
+            return error::OK;
+          }
+          break;
+        }
+      }
+      auto length = state.RawLen(-1);
+      bool is_sequence = Reader::Measure(state, length, nullptr) && length != 0;
+      if (is_sequence && value->IsArray()) {
+        stack.push_back(DiffLevel{value, pos, 0, static_cast<LUA_INTEGER>(length), {}});
+        return error::OK;
+      }
+      if (!is_sequence && value->IsTable()) {
+        stack.push_back(DiffLevel{value, pos, 0, -1, ::std::vector<bool>(value->GetSize(), false)});
+        state.Push(nullptr);
+        return error::OK;
+      }
+      break;
+    }
+    default: return error::BAD_VALUE;
+  }
+
+  if (same) {
+    state.Pop();
+    return error::OK;
+  }
+  if (auto err = Build(state, Own(stack, pos), stack.size()); err != error::OK) { return err; }
+  Record(changes, Change::kModified, path);
+  return error::OK;
+}
+
+/**
+ * @brief gives every level of the walk a private node before a write, a node shared with another
+ * version is copied and the levels below are pointed into the copy
+ */
+inline void Document::Own(::std::vector<DiffLevel> &stack) {
+  for (::std::size_t i = 0; i < stack.size(); ++i) {
+    if (i != 0) { stack[i].value_ = Child(stack[i - 1], stack[i].pos_); }
+    stack[i].value_->Detach();
+  }
+}
+
+/**
+ * @return the value at pos in the top level, or the root when the walk is empty
+ */
+inline Value *Document::Own(::std::vector<DiffLevel> &stack, ::std::size_t pos) {
+  Own(stack);
+  return stack.empty() ? this : Child(stack.back(), pos);
+}
+
+inline Value *Document::Child(const DiffLevel &level, ::std::size_t pos) {
+  if (level.length_ >= 0) { return &(*level.value_->data_.heap_.array_)[pos]; }
+  return &(level.value_->data_.heap_.table_->begin() + static_cast<Table::Members::difference_type>(pos))->value_;
+}
+
+/**
+ * @brief parses the value on the top of the stack into value, with the strings mode and the pool of the document
+ */
+inline error::ParseError Document::Build(State &state, Value *value, ::std::size_t depth) {
+  Document sub(allocator_);
+  sub.borrow_strings_ = borrow_strings_;
+  sub.intern_keys_ = intern_keys_;
+  sub.intern_strings_ = intern_strings_;
+  sub.symbols_ = symbols_;
+  if (auto err = Reader::Parse(state, sub, Reader::kDefaultMaxDepth - depth); err != error::OK) { return err; }
+  *value = ::std::move(static_cast<Value &>(sub));
+  return error::OK;
+}
+
+/**
+ * @brief the keys are copied out of the pool and the lua strings, a change set may outlive both
+ */
+inline void Document::Record(ChangeSet *changes, Change::Kind kind, const ::std::vector<Value> &path) {
+  if (changes == nullptr) { return; }
+  auto &change = changes->emplace_back(Change{kind, {}});
+  change.path_.reserve(path.size());
+  for (const auto &key : path) {
+    if (key.IsString()) { change.path_.emplace_back(key.GetStringView()); }
+    else { change.path_.push_back(key); }
+  }
+}
+
+inline void Document::Materialize() {
+  ::std::vector<Value *> stack{this};
+  while (!stack.empty()) {
+    auto *value = stack.back();
+    stack.pop_back();
+    if (value->IsTable()) {
+      for (auto &member : *value->data_.heap_.table_) {
+        if (member.value_.IsTable() || member.value_.IsArray()) { stack.push_back(&member.value_); }
+      }
+    } else if (value->IsArray()) {
+      for (auto &element : *value->data_.heap_.array_) {
+        if (element.IsTable() || element.IsArray()) { stack.push_back(&element); }
+      }
+    }
+  }
+}
+
+inline void Document::Compact() {
+  STELLA_ASSERT(stack_.empty() && "compacting a document being parsed");
+  Document fresh;
+  fresh.borrow_strings_ = borrow_strings_;
+  fresh.intern_keys_ = intern_keys_;
+  fresh.intern_strings_ = intern_strings_;
+
+  // each table and array is reserved before its children are pushed, so the targets do not move
+  ::std::vector<::std::pair<const Value *, Value *>> stack{{this, &fresh}};
+  while (!stack.empty()) {
+    auto [source, target] = stack.back();
+    stack.pop_back();
+    *target = fresh.CopyNode(*source);
+    if (source->IsTable()) {
+      const auto &members = *source->data_.heap_.table_;
+      auto &table = *target->data_.heap_.table_;
+      table.reserve(members.size());
+      for (const auto &member : members) {
+        table.emplace_back(fresh.CopyNode(member.key_), Value());
+        stack.emplace_back(&member.value_, &table.back().value_);
+      }
+    } else if (source->IsArray()) {
+      const auto &elements = *source->data_.heap_.array_;
+      auto &array = *target->data_.heap_.array_;
+      array.reserve(elements.size());
+      for (const auto &element : elements) {
+        array.emplace_back();
+        stack.emplace_back(&element, &array.back());
+      }
+    }
+  }
+
+  // the old tree is released while its pool is still alive
+  static_cast<Value &>(*this) = ::std::move(static_cast<Value &>(fresh));
+  own_symbols_ = ::std::move(fresh.own_symbols_);
+  symbols_ = own_symbols_.get();
+  fresh.symbols_ = nullptr;
+  own_allocator_ = ::std::move(fresh.own_allocator_);
+  allocator_ = own_allocator_.get();
+}
+
+/**
+ * @brief a copy of the value drawn from the pool and the symbol table of this document,
+ * tables and arrays come out empty and packed arrays are shared, they do not live in a pool
+ */
+inline Value Document::CopyNode(const Value &value) {
+  switch (value.tag()) {
+    case kHeapStringTag:
+    case kPoolStringTag: return Value(value.GetStringView(), *allocator_);
+    case kSymbolStringTag: return SymbolString(Interned(value.GetStringView()));
+    case kTableTag: return Value(S_TABLE, allocator_);
+    case kArrayTag: return Value(S_ARRAY, allocator_);
+    default: return Value(value, nullptr, true);
+  }
+}
+
+inline void Document::Pin(State &state, unsigned flags) {
+  Unpin();
+  borrow_strings_ = flags & kParseBorrowStringsFlag;
+  intern_keys_ = !borrow_strings_ && (flags & kParseInternKeysFlag);
+  intern_strings_ = !borrow_strings_ && (flags & kParseInternStringsFlag);
+  if (borrow_strings_) {
+    pinned_state_ = state;
+    pinned_ref_ = state.Ref(-1);
+  }
+}
+
+inline Symbol Document::Intern(::std::string_view str) {
+  return Symbol(Interned(str));
+}
+
+inline Value Document::MakeKey(::std::string_view str) {
+  if (borrow_strings_) { return Value(StringRef(str)); }
+  // a string stored in the value takes no storage and a symbol lookup compares its bytes anyway
+  if (intern_keys_ && str.size() > kMaxInlineLength) { return SymbolString(Interned(str)); }
+  return Value(str, *allocator_);
+}
+
+/**
+ * @brief the copy in the symbol table, its bytes live in the pool of the document
+ */
+inline ::std::string_view Document::Interned(::std::string_view str) {
+  if (symbols_ == nullptr) {
+    own_symbols_ = ::std::make_unique<::std::unordered_set<::std::string_view>>();
+    symbols_ = own_symbols_.get();
+  }
+  if (auto it = symbols_->find(str); it != symbols_->end()) { return *it; }
+  auto *bytes = static_cast<char *>(allocator_->Malloc(str.size()));
+  if (bytes == nullptr && !str.empty()) { throw ::std::bad_alloc(); }
+  if (!str.empty()) { ::std::memcpy(bytes, str.data(), str.size()); }
+  return *symbols_->emplace(bytes, str.size()).first;
+}
+
+inline void Document::Unpin() {
+  if (pinned_ref_ != LUA_NOREF) {
+    pinned_state_.Unref(pinned_ref_);
+    pinned_ref_ = LUA_NOREF;
+  }
+}
+
 inline bool Document::Nil() {
   AddValue(Value(S_NIL));
   return true;
@@ -94,7 +841,11 @@ inline bool Document::Number(double n) {
 }
 
 inline bool Document::String(::std::string_view str) {
-  AddValue(Value(str));
+  if (intern_strings_ && str.size() > kMaxInlineLength && str.size() <= kInternMaxLength) {
+    AddValue(SymbolString(Interned(str)));
+    return true;
+  }
+  AddValue(borrow_strings_ ? Value(StringRef(str)) : Value(str, *allocator_));
   return true;
 }
 
@@ -104,12 +855,19 @@ inline bool Document::Key(long long int i) {
 }
 
 inline bool Document::Key(::std::string_view str) {
-  AddValue(Value(str));
+  AddValue(MakeKey(str));
   return true;
 }
 
 inline bool Document::StartTable() {
-  stack_.emplace_back(AddValue(Value(S_TABLE)));
+  stack_.emplace_back(AddValue(Value(S_TABLE, *allocator_)));
+  return true;
+}
+
+inline bool Document::StartTable(::std::size_t narr, ::std::size_t nrec) {
+  auto *value = AddValue(Value(S_TABLE, *allocator_));
+  value->Reserve(narr + nrec);
+  stack_.emplace_back(value);
   return true;
 }
 
@@ -120,37 +878,39 @@ inline bool Document::EndTable() {
   return true;
 }
 
+inline bool Document::StartArray(::std::size_t length) {
+  auto *value = AddValue(Value(S_ARRAY, *allocator_));
+  value->Reserve(length);
+  stack_.emplace_back(value);
+  return true;
+}
+
+inline bool Document::EndArray() {
+  STELLA_ASSERT(!stack_.empty());
+  STELLA_ASSERT(stack_.back().type() == S_ARRAY);
+  stack_.pop_back();
+  return true;
+}
+
 inline Value *Document::AddValue(Value &&value) {
   auto type = value.GetType();
   (void) type;
 
   if (see_value_) { STELLA_ASSERT(!stack_.empty() && "root not singular"); }
   else {
-    STELLA_ASSERT(type_ == S_NIL);
+    STELLA_ASSERT(IsNil());
     see_value_ = true;
-    type_ = type;
-
-    switch (type) {
-      case S_NIL:break;
-      case S_BOOL:data_.emplace<S_BOOL>(::std::get<S_BOOL>(value.data_));
-        break;
-      case S_INTEGER: data_.emplace<S_INTEGER>(::std::get<S_INTEGER>(value.data_));
-        break;
-      case S_NUMBER: data_.emplace<S_NUMBER>(::std::get<S_NUMBER>(value.data_));
-        break;
-      case S_STRING: data_.emplace<S_STRING>(::std::get<S_STRING>(value.data_));
-        ::std::get<S_STRING>(value.data_) = nullptr;
-        break;
-      case S_TABLE: data_.emplace<S_TABLE>(::std::get<S_TABLE>(value.data_));
-        ::std::get<S_TABLE>(value.data_) = nullptr;
-        break;
-      default:break;
-    }
-    value.type_ = S_NIL;
+    Value::operator=(::std::move(value));
     return this;
   }
 
   auto &top = stack_.back();
+  if (top.type() == S_ARRAY) {
+    top.value_->PushBack(::std::move(value));
+    ++top.value_count_;
+    return top.last_value();
+  }
+
   STELLA_ASSERT(top.type() == S_TABLE);
   if (top.value_count_ % 2 == 0) {
     STELLA_ASSERT(type == S_INTEGER || type == S_STRING);
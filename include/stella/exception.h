@@ -18,6 +18,16 @@ namespace stella {
   _field_error(BAD_VALUE, "bad value")                 \
   _field_error(EXPECT_VALUE, "expect value")           \
   _field_error(USER_STOPPED, "user stopped Parse")     \
+  _field_error(BAD_KEY, "bad key")                     \
+  _field_error(TOO_DEEP, "nesting too deep")           \
+  _field_error(STACK_OVERFLOW, "lua stack overflow")   \
+  _field_error(OUT_OF_MEMORY, "out of memory")         \
+  _field_error(CALL_FAILED, "call failed")             \
+  _field_error(OPEN_FAILED, "open failed")             \
+  _field_error(BAD_SNAPSHOT, "bad snapshot")           \
+  _field_error(TYPE_MISMATCH, "type mismatch")         \
+  _field_error(INSTRUCTION_LIMIT, "instruction limit") \
+  _field_error(DEADLINE_EXCEEDED, "deadline exceeded") \
   //
 
 namespace error {
@@ -0,0 +1,103 @@
+//
+// Created by Homin Su on 2023/6/15.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_HANDLER_H_
+#define STELLA_INCLUDE_STELLA_HANDLER_H_
+
+#include <cstddef>
+
+#include <type_traits>
+#include <utility>
+
+namespace stella {
+
+/**
+ * The handler protocol driven by Reader::Parse and Value::WriteTo:
+ *
+ *   bool Nil();
+ *   bool Bool(bool b);
+ *   bool Integer(LUA_INTEGER i);
+ *   bool Number(LUA_NUMBER n);
+ *   bool String(::std::string_view str);
+ *   bool Key(LUA_INTEGER i);
+ *   bool Key(::std::string_view str);
+ *   bool StartTable();
+ *   bool EndTable();
+ *
+ * and the optional callbacks, detected at compile time:
+ *
+ *   bool StartArray(::std::size_t length);  // lua sequence, otherwise reported as a table with integer keys
+ *   bool EndArray();
+ *   bool StartTable(::std::size_t narr, ::std::size_t nrec);  // preferred over StartTable() when present,
+ *                                                            // sizes of the array part and the hash part
+ *   static constexpr bool kExactTableSize = true;  // the sizes must be exact, by default they are only a
+ *                                                  // lower bound, a large table is not counted in full
+ *
+ * StartTable and StartArray may return a Visit instead of a bool, kSkip leaves the subtree out,
+ * none of its keys and values are reported and no EndTable / EndArray follows.
+ */
+namespace handler {
+
+enum class Visit { kStop, kContinue, kSkip };
+
+template<typename Result>
+inline constexpr Visit ToVisit(Result result) {
+  if constexpr (::std::is_same_v<Result, Visit>) { return result; }
+  else { return result ? Visit::kContinue : Visit::kStop; }
+}
+
+template<typename Handler, typename = void>
+struct has_sized_table : ::std::false_type {};
+
+template<typename Handler>
+struct has_sized_table<Handler, ::std::void_t<
+    decltype(::std::declval<Handler &>().StartTable(::std::size_t{}, ::std::size_t{}))>> : ::std::true_type {};
+
+template<typename Handler>
+inline constexpr bool has_sized_table_v = has_sized_table<Handler>::value;
+
+template<typename Handler, typename = void>
+struct exact_table_size : ::std::false_type {};
+
+template<typename Handler>
+struct exact_table_size<Handler, ::std::void_t<decltype(Handler::kExactTableSize)>>
+    : ::std::bool_constant<Handler::kExactTableSize> {};
+
+template<typename Handler>
+inline constexpr bool exact_table_size_v = exact_table_size<Handler>::value;
+
+template<typename Handler, typename = void>
+struct has_array : ::std::false_type {};
+
+template<typename Handler>
+struct has_array<Handler, ::std::void_t<
+    decltype(::std::declval<Handler &>().StartArray(::std::size_t{})),
+    decltype(::std::declval<Handler &>().EndArray())>> : ::std::true_type {};
+
+template<typename Handler>
+inline constexpr bool has_array_v = has_array<Handler>::value;
+
+/**
+ * @brief opens a table through the sized callback when the handler has one
+ */
+template<typename Handler>
+inline Visit StartTable(Handler &handler, ::std::size_t narr, ::std::size_t nrec) {
+  if constexpr (has_sized_table_v<Handler>) { return ToVisit(handler.StartTable(narr, nrec)); }
+  else {
+    (void) narr;
+    (void) nrec;
+    return ToVisit(handler.StartTable());
+  }
+}
+
+template<typename Handler>
+inline Visit StartArray(Handler &handler, ::std::size_t length) {
+  return ToVisit(handler.StartArray(length));
+}
+
+} // namespace handler
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_HANDLER_H_
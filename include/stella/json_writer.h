@@ -0,0 +1,266 @@
+//
+// Created by Homin Su on 2023/6/22.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_JSON_WRITER_H_
+#define STELLA_INCLUDE_STELLA_JSON_WRITER_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <string_view>
+#include <vector>
+
+#include "non_copyable.h"
+#include "stella.h"
+#include "write_stream.h"
+
+#include <lua.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STELLA_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define STELLA_NEON
+#include <arm_neon.h>
+#endif
+
+namespace stella {
+
+namespace json {
+
+/**
+ * @brief escape of each byte, 0 for the bytes copied as is, 'u' for \u00XX
+ */
+inline constexpr char kEscape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+/**
+ * @brief first byte in [ptr, end) that needs an escape, 16 bytes at a time where the target has SIMD
+ */
+inline const char *FindEscape(const char *ptr, const char *end) {
+#if defined(STELLA_SSE2)
+  const auto quote = _mm_set1_epi8('"');
+  const auto backslash = _mm_set1_epi8('\\');
+  const auto control = _mm_set1_epi8(0x1f);
+  for (; end - ptr >= 16; ptr += 16) {
+    auto s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+    auto t = _mm_or_si128(_mm_cmpeq_epi8(s, quote), _mm_cmpeq_epi8(s, backslash));
+    // unsigned s <= 0x1f
+    t = _mm_or_si128(t, _mm_cmpeq_epi8(_mm_max_epu8(s, control), control));
+    auto mask = static_cast<unsigned>(_mm_movemask_epi8(t));
+    if (mask != 0) {
+#if defined(_MSC_VER)
+      unsigned long offset;
+      _BitScanForward(&offset, mask);
+      return ptr + offset;
+#else
+      return ptr + __builtin_ctz(mask);
+#endif
+    }
+  }
+#elif defined(STELLA_NEON)
+  const auto quote = vdupq_n_u8('"');
+  const auto backslash = vdupq_n_u8('\\');
+  const auto control = vdupq_n_u8(0x20);
+  for (; end - ptr >= 16; ptr += 16) {
+    auto s = vld1q_u8(reinterpret_cast<const ::std::uint8_t *>(ptr));
+    auto t = vorrq_u8(vorrq_u8(vceqq_u8(s, quote), vceqq_u8(s, backslash)), vcltq_u8(s, control));
+    if (vmaxvq_u8(t) != 0) { break; }
+  }
+#endif
+  for (; ptr != end; ++ptr) {
+    if (kEscape[static_cast<unsigned char>(*ptr)] != 0) { break; }
+  }
+  return ptr;
+}
+
+/**
+ * @brief quoted string, the bytes are taken as utf-8 and copied as they are apart from the escapes
+ */
+template<typename Stream>
+inline void PutString(Stream &stream, ::std::string_view str) {
+  static constexpr char kHex[] = "0123456789abcdef";
+
+  stream.Put('"');
+  const auto *ptr = str.data();
+  const auto *end = ptr + str.size();
+  while (ptr != end) {
+    const auto *escape = FindEscape(ptr, end);
+    stream.Puts({ptr, static_cast<::std::size_t>(escape - ptr)});
+    if (escape == end) { break; }
+
+    auto c = static_cast<unsigned char>(*escape);
+    if (kEscape[c] == 'u') {
+      auto *out = stream.Push(6);
+      out[0] = '\\';
+      out[1] = 'u';
+      out[2] = '0';
+      out[3] = '0';
+      out[4] = kHex[c >> 4];
+      out[5] = kHex[c & 0xf];
+    } else {
+      auto *out = stream.Push(2);
+      out[0] = '\\';
+      out[1] = kEscape[c];
+    }
+    ptr = escape + 1;
+  }
+  stream.Put('"');
+}
+
+} // namespace json
+
+/**
+ * @brief JSON output of the handler protocol, driven by Value::WriteTo or Reader::Parse:
+ *
+ *   stella::StringWriteStream out;
+ *   stella::JsonWriter writer(out);
+ *   doc.WriteTo(writer);
+ *
+ * lua sequences become arrays, integer keys are quoted, nil becomes null and so do the numbers JSON
+ * cannot hold, nan and the infinities. PrettyJsonWriter breaks the lines and indents.
+ */
+template<typename Stream, bool Pretty = false>
+class JsonWriter : NonCopyable {
+ private:
+  struct Level {
+    bool in_array_;
+    ::std::size_t count_;
+  };
+
+  Stream &stream_;
+  ::std::vector<Level> stack_;
+  char indent_char_ = ' ';
+  unsigned indent_count_ = 2;
+
+ public:
+  explicit JsonWriter(Stream &stream) : stream_(stream) {}
+
+  /**
+   * @brief indentation of the pretty writer, one level is count times c
+   */
+  void SetIndent(char c, unsigned count) {
+    static_assert(Pretty, "only the pretty writer indents");
+    indent_char_ = c;
+    indent_count_ = count;
+  }
+
+  bool Nil() {
+    Prefix();
+    stream_.Puts("null");
+    return Done();
+  }
+  bool Bool(bool b) {
+    Prefix();
+    stream_.Puts(b ? ::std::string_view("true") : ::std::string_view("false"));
+    return Done();
+  }
+  bool Integer(LUA_INTEGER i) {
+    Prefix();
+    PutInteger(stream_, i);
+    return Done();
+  }
+  bool Number(LUA_NUMBER n) {
+    Prefix();
+    if (::std::isfinite(n)) { PutNumber(stream_, n); }
+    else { stream_.Puts("null"); }
+    return Done();
+  }
+  bool String(::std::string_view str) {
+    Prefix();
+    json::PutString(stream_, str);
+    return Done();
+  }
+  bool Key(LUA_INTEGER i) {
+    Prefix();
+    stream_.Put('"');
+    PutInteger(stream_, i);
+    stream_.Put('"');
+    Colon();
+    return true;
+  }
+  bool Key(::std::string_view str) {
+    Prefix();
+    json::PutString(stream_, str);
+    Colon();
+    return true;
+  }
+  bool StartTable() {
+    Prefix();
+    stream_.Put('{');
+    stack_.push_back(Level{false, 0});
+    return true;
+  }
+  bool EndTable() { return End('}'); }
+  bool StartArray(::std::size_t length) {
+    (void) length;
+    Prefix();
+    stream_.Put('[');
+    stack_.push_back(Level{true, 0});
+    return true;
+  }
+  bool EndArray() { return End(']'); }
+
+  /**
+   * @brief true once a whole value has been written
+   */
+  [[nodiscard]] bool IsComplete() const { return stack_.empty(); }
+
+ private:
+  /**
+   * @brief separator before a key or an array element, a table value follows its key directly
+   */
+  void Prefix() {
+    if (stack_.empty()) { return; }
+    auto &level = stack_.back();
+    if (!level.in_array_ && level.count_ % 2 == 1) {
+      ++level.count_;
+      return;
+    }
+    if (level.count_ > 0) { stream_.Put(','); }
+    if constexpr (Pretty) { NewLine(stack_.size()); }
+    ++level.count_;
+  }
+  void Colon() {
+    if constexpr (Pretty) { stream_.Puts(": "); }
+    else { stream_.Put(':'); }
+  }
+  bool End(char c) {
+    STELLA_ASSERT(!stack_.empty());
+    auto empty = stack_.back().count_ == 0;
+    stack_.pop_back();
+    if constexpr (Pretty) { if (!empty) { NewLine(stack_.size()); }}
+    else { (void) empty; }
+    stream_.Put(c);
+    return Done();
+  }
+  /**
+   * @brief flushes the stream after the root value
+   */
+  bool Done() {
+    if (stack_.empty()) { stream_.Flush(); }
+    return true;
+  }
+  void NewLine(::std::size_t depth) {
+    stream_.Put('\n');
+    for (auto n = depth * indent_count_; n > 0; --n) { stream_.Put(indent_char_); }
+  }
+};
+
+template<typename Stream>
+using PrettyJsonWriter = JsonWriter<Stream, true>;
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_JSON_WRITER_H_
@@ -0,0 +1,188 @@
+//
+// Created by Homin Su on 2023/6/18.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_LUA_ALLOCATOR_H_
+#define STELLA_INCLUDE_STELLA_LUA_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+
+#include "allocator.h"
+#include "non_copyable.h"
+#include "stella.h"
+
+namespace stella {
+
+/**
+ * @brief lua_Alloc with size classes for the small objects lua churns through (strings, tables,
+ * closures, upvalues), blocks up to kMaxSmallSize are carved from chunks and recycled through one
+ * free list per class, larger blocks go to the C runtime.
+ *
+ * keeps live / peak bytes and allocation counts, and fails any growth beyond the limit, lua then
+ * raises a memory error that State::Call reports as OUT_OF_MEMORY. Shrinking never hits the limit.
+ *
+ * one allocator per lua state, it is not thread safe and must outlive the state:
+ *
+ *   stella::LuaAllocator allocator;
+ *   state.Open(stella::LuaAllocator::Alloc, &allocator);
+ *   allocator.SetLimit(64 << 20);
+ */
+class LuaAllocator : NonCopyable {
+ public:
+  static constexpr ::std::size_t kGranularity = 16;
+  static constexpr ::std::size_t kMaxSmallSize = 512;
+  static constexpr ::std::size_t kNumClasses = kMaxSmallSize / kGranularity;
+  static constexpr ::std::size_t kChunkCapacity = 64 * 1024;
+
+ private:
+  struct FreeBlock {
+    FreeBlock *next_;
+  };
+
+  struct Chunk {
+    Chunk *next_;
+  };
+
+  static constexpr ::std::size_t kChunkHeaderSize = STELLA_ALIGN(sizeof(Chunk));
+
+  FreeBlock *free_[kNumClasses]{};
+  Chunk *chunks_ = nullptr;
+  char *cursor_ = nullptr;
+  char *end_ = nullptr;
+
+  ::std::size_t limit_;
+  ::std::size_t live_ = 0;
+  ::std::size_t peak_ = 0;
+  ::std::size_t reserved_ = 0;
+  ::std::size_t allocations_ = 0;
+  ::std::size_t frees_ = 0;
+  ::std::size_t failures_ = 0;
+
+ public:
+  /**
+   * @param limit maximum live bytes, 0 for no limit
+   */
+  explicit LuaAllocator(::std::size_t limit = 0) : limit_(limit) {}
+  ~LuaAllocator();
+
+  static void *Alloc(void *ud, void *ptr, ::std::size_t osize, ::std::size_t nsize);
+
+  void SetLimit(::std::size_t limit) { limit_ = limit; }
+  void ResetPeak() { peak_ = live_; }
+
+  [[nodiscard]] ::std::size_t Limit() const { return limit_; }
+  [[nodiscard]] ::std::size_t LiveBytes() const { return live_; }
+  [[nodiscard]] ::std::size_t PeakBytes() const { return peak_; }
+  [[nodiscard]] ::std::size_t ReservedBytes() const { return reserved_; } // held in chunks
+  [[nodiscard]] ::std::size_t Allocations() const { return allocations_; }
+  [[nodiscard]] ::std::size_t Frees() const { return frees_; }
+  [[nodiscard]] ::std::size_t Failures() const { return failures_; }
+
+ private:
+  void *Allocate(::std::size_t size);
+  void *Reallocate(void *ptr, ::std::size_t orig_size, ::std::size_t new_size);
+  void Deallocate(void *ptr, ::std::size_t size);
+  bool AddChunk();
+
+  static ::std::size_t ClassOf(::std::size_t size) { return (size - 1) / kGranularity; }
+};
+
+inline LuaAllocator::~LuaAllocator() {
+  while (chunks_ != nullptr) {
+    Chunk *next = chunks_->next_;
+    STELLA_FREE(chunks_);
+    chunks_ = next;
+  }
+}
+
+inline void *LuaAllocator::Alloc(void *ud, void *ptr, ::std::size_t osize, ::std::size_t nsize) {
+  auto *self = static_cast<LuaAllocator *>(ud);
+  // osize is the type of the object when ptr is nullptr
+  if (ptr == nullptr) { osize = 0; }
+
+  if (nsize == 0) {
+    if (ptr != nullptr) {
+      self->Deallocate(ptr, osize);
+      self->live_ -= osize;
+      ++self->frees_;
+    }
+    return nullptr;
+  }
+
+  if (nsize > osize && self->limit_ != 0 && self->live_ - osize + nsize > self->limit_) {
+    ++self->failures_;
+    return nullptr;
+  }
+
+  void *block = ptr == nullptr ? self->Allocate(nsize) : self->Reallocate(ptr, osize, nsize);
+  if (block == nullptr) {
+    ++self->failures_;
+    return nullptr;
+  }
+
+  self->live_ = self->live_ - osize + nsize;
+  self->peak_ = ::std::max(self->peak_, self->live_);
+  if (ptr == nullptr) { ++self->allocations_; }
+  return block;
+}
+
+inline void *LuaAllocator::Allocate(::std::size_t size) {
+  if (size > kMaxSmallSize) { return STELLA_MALLOC(size); }
+
+  auto cls = ClassOf(size);
+  if (FreeBlock *block = free_[cls]) {
+    free_[cls] = block->next_;
+    return block;
+  }
+
+  auto block_size = (cls + 1) * kGranularity;
+  if (static_cast<::std::size_t>(end_ - cursor_) < block_size && !AddChunk()) { return nullptr; }
+  void *block = cursor_;
+  cursor_ += block_size;
+  return block;
+}
+
+inline void *LuaAllocator::Reallocate(void *ptr, ::std::size_t orig_size, ::std::size_t new_size) {
+  if (orig_size > kMaxSmallSize && new_size > kMaxSmallSize) { return STELLA_REALLOC(ptr, new_size); }
+  if (orig_size <= kMaxSmallSize && new_size <= kMaxSmallSize && ClassOf(orig_size) == ClassOf(new_size)) {
+    return ptr;
+  }
+
+  void *block = Allocate(new_size);
+  if (block == nullptr) { return nullptr; }
+  ::std::memcpy(block, ptr, ::std::min(orig_size, new_size));
+  Deallocate(ptr, orig_size);
+  return block;
+}
+
+inline void LuaAllocator::Deallocate(void *ptr, ::std::size_t size) {
+  if (size > kMaxSmallSize) {
+    STELLA_FREE(ptr);
+    return;
+  }
+  auto cls = ClassOf(size);
+  auto *block = static_cast<FreeBlock *>(ptr);
+  block->next_ = free_[cls];
+  free_[cls] = block;
+}
+
+/**
+ * @brief the tail of the current chunk is dropped, it is smaller than the requested class
+ */
+inline bool LuaAllocator::AddChunk() {
+  auto *chunk = static_cast<Chunk *>(STELLA_MALLOC(kChunkHeaderSize + kChunkCapacity));
+  if (chunk == nullptr) { return false; }
+  chunk->next_ = chunks_;
+  chunks_ = chunk;
+  cursor_ = reinterpret_cast<char *>(chunk) + kChunkHeaderSize;
+  end_ = cursor_ + kChunkCapacity;
+  reserved_ += kChunkHeaderSize + kChunkCapacity;
+  return true;
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_LUA_ALLOCATOR_H_
@@ -0,0 +1,270 @@
+//
+// Created by Homin Su on 2023/6/23.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_PARSE_STATS_H_
+#define STELLA_INCLUDE_STELLA_PARSE_STATS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <chrono>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "handler.h"
+#include "json_writer.h"
+#include "lua_allocator.h"
+#include "non_copyable.h"
+#include "stella.h"
+
+#include <lua.hpp>
+
+namespace stella {
+
+/**
+ * @brief what a load and parse cost, filled by StatsHandler, ParseStats::Scope and the Document::Parse
+ * overloads taking a ParseStats, nothing is collected by the calls without one:
+ *
+ *   stella::ParseStats stats;
+ *   { stella::ParseStats::Scope scope(stats, "LoadFile"); state.LoadFile("app.lua"); }
+ *   { stella::ParseStats::Scope scope(stats, "Call"); state.Call(); }
+ *   doc.Parse(state, "Application", stats);
+ *
+ *   stella::FileWriteStream out(file);
+ *   stats.WriteTrace(out);   // chrome://tracing or https://ui.perfetto.dev
+ */
+struct ParseStats {
+  using Clock = ::std::chrono::steady_clock;
+
+  struct Phase {
+    ::std::string_view name_;        // must outlive the stats, usually a literal
+    ::std::uint64_t start_ns_;       // since the construction or the last Reset
+    ::std::uint64_t duration_ns_;
+    ::std::size_t allocations_;      // by the LuaAllocator given to the scope, 0 without one
+    ::std::size_t peak_bytes_;       // growth of its peak live bytes
+  };
+
+  /**
+   * @brief times the enclosing block as one phase
+   */
+  class Scope : NonCopyable {
+   private:
+    ParseStats &stats_;
+    ::std::string_view name_;
+    const LuaAllocator *lua_allocator_;
+    Clock::time_point start_;
+    ::std::size_t allocations_;
+    ::std::size_t peak_bytes_;
+
+   public:
+    /**
+     * @param lua_allocator allocator of the state, its allocations during the phase are recorded, may be nullptr
+     */
+    Scope(ParseStats &stats, ::std::string_view name, const LuaAllocator *lua_allocator = nullptr)
+        : stats_(stats), name_(name), lua_allocator_(lua_allocator), start_(Clock::now()),
+          allocations_(lua_allocator != nullptr ? lua_allocator->Allocations() : 0),
+          peak_bytes_(lua_allocator != nullptr ? lua_allocator->PeakBytes() : 0) {}
+    ~Scope();
+  };
+
+  ::std::size_t nils_ = 0;
+  ::std::size_t bools_ = 0;
+  ::std::size_t integers_ = 0;
+  ::std::size_t numbers_ = 0;
+  ::std::size_t strings_ = 0;
+  ::std::size_t keys_ = 0;
+  ::std::size_t tables_ = 0;
+  ::std::size_t arrays_ = 0;
+  ::std::size_t string_bytes_ = 0; // of the string values and the string keys
+  ::std::size_t max_depth_ = 0;    // of the tables, the root table is at depth 1
+  ::std::size_t pool_bytes_ = 0;   // drawn from the pool of the document
+  ::std::size_t chunk_bytes_ = 0;  // obtained by the pool from the C runtime
+  ::std::vector<Phase> phases_;
+
+  Clock::time_point epoch_ = Clock::now();
+
+  /**
+   * @brief values reported, the keys not counted
+   */
+  [[nodiscard]] ::std::size_t Nodes() const {
+    return nils_ + bools_ + integers_ + numbers_ + strings_ + tables_ + arrays_;
+  }
+
+  void Reset() { *this = ParseStats(); }
+
+  /**
+   * @brief chrome trace event format, one complete event per phase and a counter event with the
+   * node counts at the end of the last phase
+   */
+  template<typename Stream>
+  void WriteTrace(Stream &stream) const;
+};
+
+inline ParseStats::Scope::~Scope() {
+  auto end = Clock::now();
+  auto ns = [](Clock::duration d) {
+    return static_cast<::std::uint64_t>(::std::chrono::duration_cast<::std::chrono::nanoseconds>(d).count());
+  };
+  Phase phase{name_, ns(start_ - stats_.epoch_), ns(end - start_), 0, 0};
+  if (lua_allocator_ != nullptr) {
+    phase.allocations_ = lua_allocator_->Allocations() - allocations_;
+    // lua frees as it goes, the live bytes would undercount a phase
+    phase.peak_bytes_ = lua_allocator_->PeakBytes() - peak_bytes_;
+  }
+  stats_.phases_.push_back(phase);
+}
+
+template<typename Stream>
+inline void ParseStats::WriteTrace(Stream &stream) const {
+  auto us = [](::std::uint64_t ns) { return static_cast<LUA_NUMBER>(ns) / 1000; };
+
+  JsonWriter<Stream> writer(stream);
+  writer.StartTable();
+  writer.Key("traceEvents");
+  writer.StartArray(phases_.size() + 1);
+  ::std::uint64_t end_ns = 0;
+  for (const auto &phase : phases_) {
+    writer.StartTable();
+    writer.Key("name");
+    writer.String(phase.name_);
+    writer.Key("cat");
+    writer.String("stella");
+    writer.Key("ph");
+    writer.String("X");
+    writer.Key("ts");
+    writer.Number(us(phase.start_ns_));
+    writer.Key("dur");
+    writer.Number(us(phase.duration_ns_));
+    writer.Key("pid");
+    writer.Integer(1);
+    writer.Key("tid");
+    writer.Integer(1);
+    writer.Key("args");
+    writer.StartTable();
+    writer.Key("allocations");
+    writer.Integer(static_cast<LUA_INTEGER>(phase.allocations_));
+    writer.Key("peak_bytes");
+    writer.Integer(static_cast<LUA_INTEGER>(phase.peak_bytes_));
+    writer.EndTable();
+    writer.EndTable();
+    end_ns = ::std::max(end_ns, phase.start_ns_ + phase.duration_ns_);
+  }
+
+  writer.StartTable();
+  writer.Key("name");
+  writer.String("nodes");
+  writer.Key("ph");
+  writer.String("C");
+  writer.Key("ts");
+  writer.Number(us(end_ns));
+  writer.Key("pid");
+  writer.Integer(1);
+  writer.Key("args");
+  writer.StartTable();
+  const ::std::pair<const char *, ::std::size_t> counters[] = {
+      {"nil", nils_}, {"bool", bools_}, {"integer", integers_}, {"number", numbers_}, {"string", strings_},
+      {"key", keys_}, {"table", tables_}, {"array", arrays_}, {"string_bytes", string_bytes_},
+      {"max_depth", max_depth_}, {"pool_bytes", pool_bytes_}, {"chunk_bytes", chunk_bytes_},
+  };
+  for (const auto &[name, count] : counters) {
+    writer.Key(name);
+    writer.Integer(static_cast<LUA_INTEGER>(count));
+  }
+  writer.EndTable();
+  writer.EndTable();
+
+  writer.EndArray();
+  writer.Key("displayTimeUnit");
+  writer.String("ns");
+  writer.EndTable();
+}
+
+/**
+ * @brief forwards the handler protocol to the wrapped handler and counts into a ParseStats, the
+ * optional callbacks are offered only when the wrapped handler has them, so the reader walks the
+ * same way with and without the wrapper
+ */
+template<typename Handler>
+class StatsHandler : NonCopyable {
+ private:
+  Handler &handler_;
+  ParseStats &stats_;
+  ::std::size_t depth_ = 0;
+
+ public:
+  static constexpr bool kExactTableSize = handler::exact_table_size_v<Handler>;
+
+  StatsHandler(Handler &handler, ParseStats &stats) : handler_(handler), stats_(stats) {}
+
+  bool Nil() {
+    ++stats_.nils_;
+    return handler_.Nil();
+  }
+  bool Bool(bool b) {
+    ++stats_.bools_;
+    return handler_.Bool(b);
+  }
+  bool Integer(LUA_INTEGER i) {
+    ++stats_.integers_;
+    return handler_.Integer(i);
+  }
+  bool Number(LUA_NUMBER n) {
+    ++stats_.numbers_;
+    return handler_.Number(n);
+  }
+  bool String(::std::string_view str) {
+    ++stats_.strings_;
+    stats_.string_bytes_ += str.size();
+    return handler_.String(str);
+  }
+  bool Key(LUA_INTEGER i) {
+    ++stats_.keys_;
+    return handler_.Key(i);
+  }
+  bool Key(::std::string_view str) {
+    ++stats_.keys_;
+    stats_.string_bytes_ += str.size();
+    return handler_.Key(str);
+  }
+  auto StartTable() {
+    ++stats_.tables_;
+    return Enter(handler_.StartTable());
+  }
+  template<typename H = Handler, typename = ::std::enable_if_t<handler::has_sized_table_v<H>>>
+  auto StartTable(::std::size_t narr, ::std::size_t nrec) {
+    ++stats_.tables_;
+    return Enter(handler_.StartTable(narr, nrec));
+  }
+  bool EndTable() {
+    --depth_;
+    return handler_.EndTable();
+  }
+  template<typename H = Handler, typename = ::std::enable_if_t<handler::has_array_v<H>>>
+  auto StartArray(::std::size_t length) {
+    ++stats_.arrays_;
+    return Enter(handler_.StartArray(length));
+  }
+  template<typename H = Handler, typename = ::std::enable_if_t<handler::has_array_v<H>>>
+  bool EndArray() {
+    --depth_;
+    return handler_.EndArray();
+  }
+
+ private:
+  /**
+   * @brief a skipped or stopped table has no end callback, it only counts toward the depth while open
+   */
+  template<typename Result>
+  Result Enter(Result result) {
+    stats_.max_depth_ = ::std::max(stats_.max_depth_, depth_ + 1);
+    if (handler::ToVisit(result) == handler::Visit::kContinue) { ++depth_; }
+    return result;
+  }
+};
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_PARSE_STATS_H_
@@ -0,0 +1,297 @@
+//
+// Created by Homin Su on 2023/6/24.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_PROFILER_H_
+#define STELLA_INCLUDE_STELLA_PROFILER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "non_copyable.h"
+#include "state.h"
+#include "stella.h"
+#include "write_stream.h"
+
+#include <lua.hpp>
+
+namespace stella {
+
+/**
+ * @brief sampling profiler of the lua code run by a state, a count hook takes a sample every period
+ * virtual machine instructions and records the call stack with lua_getinfo:
+ *
+ *   stella::Profiler profiler;
+ *   profiler.Start(state);
+ *   state.Call();
+ *   profiler.Stop(state);
+ *
+ *   stella::FileWriteStream out(file);
+ *   profiler.WriteFolded(out);   // flamegraph.pl, speedscope, inferno
+ *
+ * the cost is bounded: a sample walks at most max_depth frames from the running one, a stack seen
+ * before is counted without allocating, and at most max_stacks distinct stacks are kept, the samples
+ * of any other stack are only counted as dropped. The name of a function is looked up once.
+ *
+ * a state has a single hook, the profiler replaces any other until Stop, which must be called before
+ * the profiler dies or the state is closed. It is not thread safe, one profiler per running state.
+ */
+class Profiler : NonCopyable {
+ public:
+  static constexpr int kDefaultPeriod = 10000;               // instructions between two samples
+  static constexpr ::std::size_t kDefaultMaxDepth = 64;      // frames kept from the running one
+  static constexpr ::std::size_t kDefaultMaxStacks = 1u << 14;
+
+  /**
+   * @brief samples of a function or of one line of it, self counts the samples taken while it
+   * was running, total those taken while it was on the stack
+   */
+  struct Entry {
+    ::std::string function_;
+    int line_;                // 0 for a whole function
+    ::std::size_t self_;
+    ::std::size_t total_;
+  };
+
+ private:
+  struct Function {
+    ::std::string source_;
+    int line_defined_;
+    ::std::string label_;
+  };
+  using Frame = ::std::uint64_t;  // index of the function << 32 | current line
+
+  struct StackHash {
+    ::std::size_t operator()(const ::std::vector<Frame> &stack) const {
+      ::std::uint64_t h = 14695981039346656037ull;
+      for (auto frame : stack) { h = (h ^ frame) * 1099511628211ull; }
+      return static_cast<::std::size_t>(h);
+    }
+  };
+
+  int period_;
+  ::std::size_t max_depth_;
+  ::std::size_t max_stacks_;
+  ::std::vector<Function> functions_;
+  ::std::unordered_map<::std::uint64_t, ::std::uint32_t> function_index_; // hash of source and line, probed
+  ::std::unordered_map<::std::vector<Frame>, ::std::size_t, StackHash> stacks_;  // running frame first
+  ::std::vector<Frame> scratch_;
+  ::std::size_t samples_ = 0;
+  ::std::size_t dropped_ = 0;
+
+  static inline const char kRegistryKey = 0;
+
+ public:
+  /**
+   * @param period instructions between two samples, the overhead is roughly max_depth calls of
+   * lua_getinfo per period
+   */
+  explicit Profiler(int period = kDefaultPeriod, ::std::size_t max_depth = kDefaultMaxDepth,
+                    ::std::size_t max_stacks = kDefaultMaxStacks)
+      : period_(period), max_depth_(max_depth), max_stacks_(max_stacks) {
+    STELLA_ASSERT(period > 0 && max_depth > 0);
+  }
+
+  /**
+   * @brief installs the hook on an opened state, the samples add up over several runs until Clear
+   */
+  void Start(State &state);
+  void Stop(State &state);
+  void Clear();
+
+  [[nodiscard]] ::std::size_t Samples() const { return samples_; }
+  [[nodiscard]] ::std::size_t Dropped() const { return dropped_; }
+
+  /**
+   * @brief flat profile by function, or by function and line, most self samples first
+   */
+  [[nodiscard]] ::std::vector<Entry> Flat(bool lines = true) const;
+
+  /**
+   * @brief folded stacks, one line per stack from the outermost frame, "a;b;c 42", the frames are
+   * "name source:line of the definition", with lines the current line of each frame follows
+   */
+  template<typename Stream>
+  void WriteFolded(Stream &stream, bool lines = false) const;
+
+ private:
+  static void Hook(lua_State *lua_state, lua_Debug *debug);
+  void Sample(lua_State *lua_state);
+  ::std::uint32_t FunctionOf(lua_State *lua_state, lua_Debug *debug);
+  [[nodiscard]] ::std::string Label(Frame frame, bool lines) const;
+};
+
+inline void Profiler::Start(State &state) {
+  auto *lua_state = state.lua_state_;
+  STELLA_ASSERT(lua_state != nullptr && "lua state not opened");
+  lua_pushlightuserdata(lua_state, this);
+  lua_rawsetp(lua_state, LUA_REGISTRYINDEX, &kRegistryKey);
+  lua_sethook(lua_state, Hook, LUA_MASKCOUNT, period_);
+}
+
+inline void Profiler::Stop(State &state) {
+  auto *lua_state = state.lua_state_;
+  STELLA_ASSERT(lua_state != nullptr && "lua state not opened");
+  lua_sethook(lua_state, nullptr, 0, 0);
+  lua_pushnil(lua_state);
+  lua_rawsetp(lua_state, LUA_REGISTRYINDEX, &kRegistryKey);
+}
+
+inline void Profiler::Clear() {
+  functions_.clear();
+  function_index_.clear();
+  stacks_.clear();
+  samples_ = 0;
+  dropped_ = 0;
+}
+
+inline void Profiler::Hook(lua_State *lua_state, lua_Debug *debug) {
+  (void) debug;
+  lua_rawgetp(lua_state, LUA_REGISTRYINDEX, &kRegistryKey);
+  auto *self = static_cast<Profiler *>(lua_touserdata(lua_state, -1));
+  lua_pop(lua_state, 1);
+  if (self == nullptr) { return; }
+  // an exception must not unwind through the lua frames
+  try {
+    self->Sample(lua_state);
+  } catch (...) {
+    ++self->dropped_;
+  }
+}
+
+inline void Profiler::Sample(lua_State *lua_state) {
+  ++samples_;
+  scratch_.clear();
+  lua_Debug debug;
+  for (int level = 0; static_cast<::std::size_t>(level) < max_depth_; ++level) {
+    if (!lua_getstack(lua_state, level, &debug)) { break; }
+    lua_getinfo(lua_state, "Sl", &debug);
+    auto line = static_cast<::std::uint32_t>(::std::max(debug.currentline, 0));
+    scratch_.push_back(static_cast<Frame>(FunctionOf(lua_state, &debug)) << 32 | line);
+  }
+
+  if (auto it = stacks_.find(scratch_); it != stacks_.end()) {
+    ++it->second;
+  } else if (stacks_.size() < max_stacks_) {
+    stacks_.emplace(scratch_, 1);
+  } else {
+    ++dropped_;
+  }
+}
+
+/**
+ * @brief functions are told apart by source and line of the definition, the name is the one of
+ * the first call seen
+ */
+inline ::std::uint32_t Profiler::FunctionOf(lua_State *lua_state, lua_Debug *debug) {
+  ::std::string_view source(debug->short_src);
+  auto h = static_cast<::std::uint64_t>(debug->linedefined) * 1099511628211ull;
+  for (auto c : source) { h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull; }
+
+  for (;; ++h) {
+    auto it = function_index_.find(h);
+    if (it == function_index_.end()) { break; }
+    const auto &function = functions_[it->second];
+    if (function.line_defined_ == debug->linedefined && function.source_ == source) { return it->second; }
+  }
+
+  ::std::string label;
+  if (::std::strcmp(debug->what, "main") == 0) {
+    label = "main chunk";
+  } else {
+    lua_getinfo(lua_state, "n", debug);
+    label = debug->name != nullptr ? debug->name : "?";
+  }
+  label += ' ';
+  label += source;
+  if (debug->linedefined > 0) {
+    label += ':';
+    label += ::std::to_string(debug->linedefined);
+  }
+  // ';' separates the frames of a folded stack
+  ::std::replace(label.begin(), label.end(), ';', '_');
+
+  auto index = static_cast<::std::uint32_t>(functions_.size());
+  functions_.push_back(Function{::std::string(source), debug->linedefined, ::std::move(label)});
+  function_index_.emplace(h, index);
+  return index;
+}
+
+inline ::std::string Profiler::Label(Frame frame, bool lines) const {
+  auto label = functions_[static_cast<::std::size_t>(frame >> 32)].label_;
+  auto line = static_cast<::std::uint32_t>(frame);
+  if (lines && line != 0) {
+    label += " @";
+    label += ::std::to_string(line);
+  }
+  return label;
+}
+
+inline ::std::vector<Profiler::Entry> Profiler::Flat(bool lines) const {
+  struct Count {
+    ::std::size_t self_ = 0;
+    ::std::size_t total_ = 0;
+  };
+  auto key_of = [lines](Frame frame) { return lines ? frame : frame & ~Frame{0xffffffff}; };
+
+  ::std::unordered_map<Frame, Count> counts;
+  ::std::vector<Frame> seen;
+  for (const auto &[stack, samples] : stacks_) {
+    if (stack.empty()) { continue; }
+    counts[key_of(stack.front())].self_ += samples;
+    // a recursive function counts once per sample
+    seen.clear();
+    for (auto frame : stack) { seen.push_back(key_of(frame)); }
+    ::std::sort(seen.begin(), seen.end());
+    seen.erase(::std::unique(seen.begin(), seen.end()), seen.end());
+    for (auto key : seen) { counts[key].total_ += samples; }
+  }
+
+  ::std::vector<Entry> entries;
+  entries.reserve(counts.size());
+  for (const auto &[key, count] : counts) {
+    entries.push_back(Entry{functions_[static_cast<::std::size_t>(key >> 32)].label_,
+                            static_cast<int>(static_cast<::std::uint32_t>(key)), count.self_, count.total_});
+  }
+  ::std::sort(entries.begin(), entries.end(), [](const Entry &lhs, const Entry &rhs) {
+    if (lhs.self_ != rhs.self_) { return lhs.self_ > rhs.self_; }
+    if (lhs.total_ != rhs.total_) { return lhs.total_ > rhs.total_; }
+    return lhs.function_ != rhs.function_ ? lhs.function_ < rhs.function_ : lhs.line_ < rhs.line_;
+  });
+  return entries;
+}
+
+template<typename Stream>
+inline void Profiler::WriteFolded(Stream &stream, bool lines) const {
+  // stacks differing only by lines fold together, the map also sorts the output
+  ::std::map<::std::string, ::std::size_t> folded;
+  ::std::string text;
+  for (const auto &[stack, samples] : stacks_) {
+    text.clear();
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+      if (it != stack.rbegin()) { text += ';'; }
+      text += Label(*it, lines);
+    }
+    folded[text] += samples;
+  }
+
+  for (const auto &[stack, samples] : folded) {
+    stream.Puts(stack);
+    stream.Put(' ');
+    PutInteger(stream, static_cast<LUA_INTEGER>(samples));
+    stream.Put('\n');
+  }
+  stream.Flush();
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_PROFILER_H_
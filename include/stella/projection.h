@@ -0,0 +1,99 @@
+//
+// Created by Homin Su on 2023/6/20.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_PROJECTION_H_
+#define STELLA_INCLUDE_STELLA_PROJECTION_H_
+
+#include <cstddef>
+
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "stella.h"
+
+#include <lua.hpp>
+
+namespace stella {
+
+/**
+ * @brief set of key paths compiled into a trie, Reader::Parse with a projection fetches only those
+ * branches and never walks the rest of the tables.
+ *
+ * a path is a list of keys separated by '.', a key made of digits only is an integer key, the empty
+ * path selects the whole value:
+ *
+ *   stella::Projection projection{"Application.Width", "Application.Array", "Servers.1.Host"};
+ *
+ * the value at the end of a path is taken as a whole, a path that is a prefix of another one wins.
+ */
+class Projection {
+ public:
+  struct Node {
+    bool integer_key_ = false;
+    LUA_INTEGER index_ = 0;
+    ::std::string name_;
+    bool whole_ = false;                  // a path ends here
+    ::std::vector<::std::size_t> children_;
+  };
+
+ private:
+  ::std::vector<Node> nodes_;
+
+ public:
+  Projection() : nodes_(1) {}
+  Projection(::std::initializer_list<::std::string_view> paths);
+
+  Projection &Add(::std::string_view path);
+
+  [[nodiscard]] const Node &Root() const { return nodes_.front(); }
+  [[nodiscard]] const Node &Child(const Node &node, ::std::size_t i) const { return nodes_[node.children_[i]]; }
+
+ private:
+  ::std::size_t FindOrAdd(::std::size_t parent, ::std::string_view key);
+};
+
+inline Projection::Projection(::std::initializer_list<::std::string_view> paths) : nodes_(1) {
+  for (auto path : paths) { Add(path); }
+}
+
+inline Projection &Projection::Add(::std::string_view path) {
+  ::std::size_t node = 0;
+  while (!path.empty() && !nodes_[node].whole_) {
+    auto dot = path.find('.');
+    node = FindOrAdd(node, path.substr(0, dot));
+    path = dot == ::std::string_view::npos ? ::std::string_view() : path.substr(dot + 1);
+  }
+  // the subtree is taken as a whole, the longer paths under it are moot
+  nodes_[node].whole_ = true;
+  nodes_[node].children_.clear();
+  return *this;
+}
+
+inline ::std::size_t Projection::FindOrAdd(::std::size_t parent, ::std::string_view key) {
+  Node child;
+  child.integer_key_ = !key.empty() && key.find_first_not_of("0123456789") == ::std::string_view::npos;
+  if (child.integer_key_) {
+    for (auto c : key) { child.index_ = child.index_ * 10 + (c - '0'); }
+  } else {
+    child.name_ = key;
+  }
+
+  for (auto i : nodes_[parent].children_) {
+    const auto &node = nodes_[i];
+    if (node.integer_key_ == child.integer_key_ && node.index_ == child.index_ && node.name_ == child.name_) {
+      return i;
+    }
+  }
+
+  nodes_.push_back(::std::move(child));
+  nodes_[parent].children_.push_back(nodes_.size() - 1);
+  return nodes_.size() - 1;
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_PROJECTION_H_
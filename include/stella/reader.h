@@ -5,117 +5,323 @@
 #ifndef STELLA_INCLUDE_STELLA_READER_H_
 #define STELLA_INCLUDE_STELLA_READER_H_
 
+#include <cstddef>
+
+#include <limits>
 #include <string>
+#include <vector>
 
 #include "exception.h"
+#include "handler.h"
 #include "non_copyable.h"
+#include "projection.h"
 #include "state.h"
 #include "value.h"
 
 namespace stella {
 
+enum ParseFlag {
+  kParseDefaultFlags = 0,
+  kParseBorrowStringsFlag = 1 << 0, // strings borrow the bytes of the lua strings instead of copying them
+  kParseLazyFlag = 1 << 1,          // Document only, tables are converted on first access
+  kParseLazyKeysFlag = 1 << 2,      // with kParseLazyFlag, a lookup converts only the key looked up
+  kParseInternKeysFlag = 1 << 3,    // Document only, equal string keys share one copy of their bytes
+  kParseInternStringsFlag = 1 << 4, // Document only, so do short string values
+};
+
 class Reader : NonCopyable {
  public:
+  static constexpr ::std::size_t kDefaultMaxDepth = 1u << 16;
+
+  /**
+   * @brief converts the value on the top of the stack and pops it, tables are walked
+   * with an explicit stack, so the cost per node does not depend on the nesting depth
+   * @param max_depth nesting depth beyond which parsing fails with TOO_DEEP
+   */
   template<typename Handler>
-  static error::ParseError Parse(State &state, Handler &handler);
+  static error::ParseError Parse(State &state, Handler &handler, ::std::size_t max_depth = kDefaultMaxDepth);
+
+  /**
+   * @brief converts only the branches of the value on the top of the stack named by the projection and
+   * pops it, each key of the trie is fetched with a raw get, the selected subtrees are converted whole.
+   * Keys absent from lua and paths running through a value that is not a table are left out, so a
+   * projected table holds only the keys that were found.
+   */
+  template<typename Handler>
+  static error::ParseError Parse(State &state, const Projection &projection, Handler &handler,
+                                 ::std::size_t max_depth = kDefaultMaxDepth);
+
+  struct TableSize {
+    ::std::size_t narr_ = 0;
+    ::std::size_t nrec_ = 0;
+  };
+
+  static constexpr ::std::size_t kMeasureLimit = 64;  // entries counted of a table that is not a sequence
+
+  static bool Measure(State &state, ::std::size_t length, TableSize *size,
+                      ::std::size_t limit = ::std::numeric_limits<::std::size_t>::max());
 
  private:
+  struct Level {
+    LUA_INTEGER index_;  // last position read from a sequence
+    LUA_INTEGER length_; // length of a sequence, -1 for a table walked with lua_next
+  };
+
+  template<typename Handler>
+  static error::ParseError ParseNil(State &state, Handler &handler);
+
   template<typename Handler>
-  static void ParseNil(State &state, Handler &handler);
+  static error::ParseError ParseBool(State &state, Handler &handler);
 
   template<typename Handler>
-  static void ParseBool(State &state, Handler &handler);
+  static error::ParseError ParseNumber(State &state, Handler &handler);
 
   template<typename Handler>
-  static void ParseInteger(State &state, Handler &handler, bool is_key);
+  static error::ParseError ParseString(State &state, Handler &handler);
 
   template<typename Handler>
-  static void ParseNumber(State &state, Handler &handler);
+  static error::ParseError ParseKey(State &state, Handler &handler);
 
   template<typename Handler>
-  static void ParseString(State &state, Handler &handler, bool is_key);
+  static error::ParseError ParseTable(State &state, Handler &handler,
+                                      ::std::vector<Level> &stack, ::std::size_t max_depth);
 
   template<typename Handler>
-  static void ParseTable(State &state, Handler &handler);
+  static error::ParseError ParseValue(State &state, Handler &handler,
+                                      ::std::vector<Level> &stack, ::std::size_t max_depth);
 
   template<typename Handler>
-  static void ParseValue(State &state, Handler &handler);
+  static error::ParseError ParseProjected(State &state, const Projection &projection, const Projection::Node &node,
+                                          Handler &handler, ::std::size_t depth, ::std::size_t max_depth);
+
+  static void PushChild(State &state, const Projection::Node &node);
+  static bool Selects(State &state, const Projection::Node &node);
 };
 
+#define CALL(expr) do { if (!(expr)) { return error::USER_STOPPED; } } while (false)
+
+// a skipped table is popped as if it had been walked
+#define VISIT(expr) do { switch (expr) { \
+    case handler::Visit::kStop: return error::USER_STOPPED; \
+    case handler::Visit::kSkip: state.Pop(); return error::OK; \
+    case handler::Visit::kContinue: break; } } while (false)
+
 template<typename Handler>
-inline error::ParseError Reader::Parse(State &state, Handler &handler) {
-  try {
-    ParseValue(state, handler);
-    return error::OK;
-  } catch (Exception &e) {
-    return e.err();
+inline error::ParseError Reader::Parse(State &state, Handler &handler, ::std::size_t max_depth) {
+  STELLA_ASSERT(state.StackSize() > 0);
+  auto base = state.StackSize() - 1;
+
+  ::std::vector<Level> stack;
+  auto err = ParseValue(state, handler, stack, max_depth);
+
+  while (err == error::OK && !stack.empty()) {
+    auto &top = stack.back();
+    if (top.length_ >= 0 ? top.index_ < top.length_ : state.HasNext(-2)) {
+      if (top.length_ >= 0) {
+        ++top.index_;
+        if constexpr (!handler::has_array_v<Handler>) {
+          if (!handler.Key(top.index_)) {
+            err = error::USER_STOPPED;
+            break;
+          }
+        }
+        state.RawGet(-1, top.index_);
+      } else if ((err = ParseKey(state, handler)) != error::OK) {
+        break;
+      }
+      err = ParseValue(state, handler, stack, max_depth);
+      continue;
+    }
+
+    bool ok;
+    if constexpr (handler::has_array_v<Handler>) { ok = top.length_ >= 0 ? handler.EndArray() : handler.EndTable(); }
+    else { ok = handler.EndTable(); }
+    stack.pop_back();
+    state.Pop();
+    if (!ok) { err = error::USER_STOPPED; }
   }
-}
 
-#define CALL(expr) if (!(expr)) throw Exception(error::USER_STOPPED)
+  // leave the stack as if the value had been consumed
+  if (err != error::OK) { state.Pop(state.StackSize() - base); }
+  return err;
+}
 
 template<typename Handler>
-inline void Reader::ParseNil(State &state, Handler &handler) {
+inline error::ParseError Reader::ParseNil(State &state, Handler &handler) {
   CALL(handler.Nil());
   state.Pop();
+  return error::OK;
 }
 
 template<typename Handler>
-inline void Reader::ParseBool(State &state, Handler &handler) {
+inline error::ParseError Reader::ParseBool(State &state, Handler &handler) {
   if (bool val; state.Top(&val)) { CALL(handler.Bool(val)); }
   state.Pop();
+  return error::OK;
 }
 
 template<typename Handler>
-inline void Reader::ParseInteger(State &state, Handler &handler, bool is_key) {
-  int index = is_key ? -2 : -1;
-  if (LUA_INTEGER val; state.Get(&val, index)) {
-    if (is_key) { CALL(handler.Key(val)); }
-    else { CALL(handler.Integer(val)); }
-  }
-  if (!is_key) { state.Pop(); }
+inline error::ParseError Reader::ParseNumber(State &state, Handler &handler) {
+  if (LUA_INTEGER i; state.Top(&i)) { CALL(handler.Integer(i)); }
+  else if (LUA_NUMBER n; state.Top(&n)) { CALL(handler.Number(n)); }
+  state.Pop();
+  return error::OK;
 }
 
 template<typename Handler>
-inline void Reader::ParseNumber(State &state, Handler &handler) {
-  if (LUA_NUMBER val; state.Top(&val)) { CALL(handler.Number(val)); }
+inline error::ParseError Reader::ParseString(State &state, Handler &handler) {
+  if (::std::string_view val; state.Get(&val, -1)) { CALL(handler.String(val)); }
   state.Pop();
+  return error::OK;
 }
 
 template<typename Handler>
-inline void Reader::ParseString(State &state, Handler &handler, bool is_key) {
-  int index = is_key ? -2 : -1;
-  if (::std::string val; state.Get(&val, index)) {
-    if (is_key) { CALL(handler.Key(val)); }
-    else { CALL(handler.String(val)); }
-  }
-  if (!is_key) { state.Pop(); }
+inline error::ParseError Reader::ParseKey(State &state, Handler &handler) {
+  if (LUA_INTEGER i; state.Get(&i, -2)) { CALL(handler.Key(i)); }
+  else if (::std::string_view str; state.Get(&str, -2)) { CALL(handler.Key(str)); }
+  else { return error::BAD_KEY; }
+  return error::OK;
 }
 
 template<typename Handler>
-inline void Reader::ParseTable(State &state, Handler &handler) {
-  CALL(handler.StartTable());
+inline error::ParseError Reader::ParseTable(State &state, Handler &handler,
+                                            ::std::vector<Level> &stack, ::std::size_t max_depth) {
+  if (stack.size() >= max_depth) { return error::TOO_DEEP; }
+  // the table walk needs a key and a value above the table
+  if (!state.CheckStack(3)) { return error::STACK_OVERFLOW; }
+
+  auto length = state.RawLen(-1);
+  TableSize size;
+  if (bool is_sequence = Measure(state, length, handler::has_sized_table_v<Handler> ? &size : nullptr,
+                                 handler::exact_table_size_v<Handler> ? ::std::numeric_limits<::std::size_t>::max()
+                                                                      : kMeasureLimit);
+      length != 0 && is_sequence) {
+    handler::Visit visit;
+    if constexpr (handler::has_array_v<Handler>) { visit = handler::StartArray(handler, length); }
+    else { visit = handler::StartTable(handler, length, 0); }
+    VISIT(visit);
+    stack.push_back(Level{0, static_cast<LUA_INTEGER>(length)});
+    return error::OK;
+  }
+
+  VISIT(handler::StartTable(handler, size.narr_, size.nrec_));
   state.Push(nullptr);
-  while (state.HasNext(-2)) {
-    state.IsInteger(-2) ? ParseInteger(state, handler, true) : ParseString(state, handler, true);
-    ParseValue(state, handler);
+  stack.push_back(Level{0, -1});
+  return error::OK;
+}
+
+template<typename Handler>
+inline error::ParseError Reader::ParseValue(State &state, Handler &handler,
+                                            ::std::vector<Level> &stack, ::std::size_t max_depth) {
+  Type type;
+  if (!state.GetType(&type, -1)) { return error::BAD_VALUE; }
+  switch (type) {
+    case S_NIL: return ParseNil(state, handler);
+    case S_BOOL: return ParseBool(state, handler);
+    case S_NUMBER: return ParseNumber(state, handler);
+    case S_STRING: return ParseString(state, handler);
+    case S_TABLE: return ParseTable(state, handler, stack, max_depth);
+    default: return error::BAD_VALUE;
+  }
+}
+
+template<typename Handler>
+inline error::ParseError Reader::Parse(State &state, const Projection &projection, Handler &handler,
+                                       ::std::size_t max_depth) {
+  STELLA_ASSERT(state.StackSize() > 0);
+  auto base = state.StackSize() - 1;
+  auto err = ParseProjected(state, projection, projection.Root(), handler, 0, max_depth);
+  if (err != error::OK) { state.Pop(state.StackSize() - base); }
+  return err;
+}
+
+/**
+ * @brief the trie is walked recursively, its depth is the length of the longest path, the keys of a
+ * level are fetched twice, once to size the table and once to convert the values
+ */
+template<typename Handler>
+inline error::ParseError Reader::ParseProjected(State &state, const Projection &projection,
+                                                const Projection::Node &node, Handler &handler,
+                                                ::std::size_t depth, ::std::size_t max_depth) {
+  if (node.whole_) { return Parse(state, handler, max_depth - depth); }
+  if (depth >= max_depth) { return error::TOO_DEEP; }
+  if (!state.CheckStack(3)) { return error::STACK_OVERFLOW; }
+
+  ::std::size_t found = 0;
+  if (state.IsTable(-1)) {
+    for (::std::size_t i = 0; i < node.children_.size(); ++i) {
+      PushChild(state, projection.Child(node, i));
+      found += Selects(state, projection.Child(node, i));
+      state.Pop();
+    }
+  }
+
+  VISIT(handler::StartTable(handler, 0, found));
+  for (::std::size_t i = 0; i < node.children_.size() && found != 0; ++i) {
+    const auto &child = projection.Child(node, i);
+    PushChild(state, child);
+    if (!Selects(state, child)) {
+      state.Pop();
+      continue;
+    }
+    if (child.integer_key_) { CALL(handler.Key(child.index_)); }
+    else { CALL(handler.Key(::std::string_view(child.name_))); }
+    if (auto err = ParseProjected(state, projection, child, handler, depth + 1, max_depth); err != error::OK) {
+      return err;
+    }
   }
   CALL(handler.EndTable());
   state.Pop();
+  return error::OK;
+}
+
+inline void Reader::PushChild(State &state, const Projection::Node &node) {
+  if (node.integer_key_) { state.RawGet(-1, node.index_); }
+  else { state.RawGet(-1, node.name_); }
 }
 
+/**
+ * @brief whether the value on the top is kept, inner nodes of the trie need a table to descend into
+ */
+inline bool Reader::Selects(State &state, const Projection::Node &node) {
+  if (state.IsNil(-1)) { return false; }
+  return node.whole_ || state.IsTable(-1);
+}
+
+#undef VISIT
 #undef CALL
 
-template<typename Handler>
-inline void Reader::ParseValue(State &state, Handler &handler) {
-  switch (state.GetType(-1)) {
-    case S_NIL: return ParseNil(state, handler);
-    case S_BOOL: return ParseBool(state, handler);
-    case S_NUMBER: return ParseNumber(state, handler);
-    case S_STRING: return ParseString(state, handler, false);
-    case S_TABLE: return ParseTable(state, handler);
-    default: throw Exception(error::BAD_VALUE);
+/**
+ * @brief checks whether the table on the top is the sequence [1, length], when size is not nullptr
+ * the entries are counted, integer keys in [1, length] as the array part and the others as the hash part,
+ * otherwise it stops at the first key out of the sequence. Once the table is known not to be a sequence
+ * the count stops after limit entries, the sizes are then a lower bound and a hash table is not walked
+ * a second time in full
+ */
+inline bool Reader::Measure(State &state, ::std::size_t length, TableSize *size, ::std::size_t limit) {
+  if (length == 0 && size == nullptr) { return false; }
+
+  ::std::size_t narr = 0, nrec = 0;
+  state.Push(nullptr);
+  while (state.HasNext(-2)) {
+    if (LUA_INTEGER key; state.Get(&key, -2) && key >= 1 && static_cast<::std::size_t>(key) <= length) { ++narr; }
+    else if (size != nullptr) { ++nrec; }
+    else {
+      state.Pop(2);
+      return false;
+    }
+    state.Pop();
+    if ((length == 0 || nrec != 0) && narr + nrec >= limit) {
+      state.Pop();
+      break;
+    }
+  }
+
+  if (size != nullptr) {
+    size->narr_ = narr;
+    size->nrec_ = nrec;
   }
+  return nrec == 0 && narr == length;
 }
 
 } // namespace stella
@@ -0,0 +1,740 @@
+//
+// Created by Homin Su on 2023/6/19.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_SNAPSHOT_H_
+#define STELLA_INCLUDE_STELLA_SNAPSHOT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "chunk_cache.h"
+#include "exception.h"
+#include "handler.h"
+#include "non_copyable.h"
+#include "stella.h"
+#include "value.h"
+
+namespace stella {
+
+/**
+ * Position independent image of a value, every reference is an offset so the image can be
+ * mapped at any address and shared between processes:
+ *
+ *   Header    magic, version, byte order, section offsets and the root node
+ *   tables    table and sequence records, 8-byte aligned
+ *   strings   string bytes, each one followed by a '\0'
+ *
+ * a node is 16 bytes { type, size, payload }, the payload holds a boolean, an integer or the bits
+ * of a number inline, or the offset of a string in the strings section, or of a record in the
+ * tables section. A sequence record is an array of nodes, a table record is
+ *
+ *   uint64 capacity | { key node, value node } x size | uint32 slot x capacity
+ *
+ * where tables of Table::kIndexThreshold members or more carry an open addressing index of
+ * member position + 1, probed with Table::Hash.
+ */
+namespace snapshot {
+
+inline constexpr char kMagic[4] = {'S', 'T', 'S', 'N'};
+inline constexpr ::std::uint32_t kVersion = 1;
+inline constexpr ::std::uint32_t kByteOrder = 0x01020304;
+
+struct Node {
+  ::std::uint32_t type_;
+  ::std::uint32_t size_;    // string length, member or element count
+  ::std::uint64_t payload_;
+};
+
+struct Member {
+  Node key_;
+  Node value_;
+};
+
+struct Header {
+  char magic_[4];
+  ::std::uint32_t version_;
+  ::std::uint32_t byte_order_;
+  ::std::uint32_t reserved_;
+  ::std::uint64_t size_;
+  ::std::uint64_t tables_offset_;
+  ::std::uint64_t tables_size_;
+  ::std::uint64_t strings_offset_;
+  ::std::uint64_t strings_size_;
+  Node root_;
+};
+
+static_assert(sizeof(Node) == 16 && sizeof(Member) == 32 && sizeof(Header) % 8 == 0, "unexpected padding");
+
+} // namespace snapshot
+
+/**
+ * @brief handler building a snapshot, driven by Value::WriteTo or straight from lua by Reader::Parse,
+ * it needs the sizes of the tables up front so it only accepts the sized StartTable
+ */
+class SnapshotWriter : NonCopyable {
+ private:
+  struct Level {
+    ::std::uint64_t record_;  // offset of the first node or member
+    ::std::uint32_t size_;
+    ::std::uint32_t count_;   // nodes or members written
+    bool is_table_;
+    bool has_key_;
+    ::std::vector<::std::uint32_t> hashes_; // key hashes of an indexed table
+  };
+
+  static constexpr ::std::size_t kInternMaxLength = 64;
+
+  ::std::string tables_;
+  ::std::string strings_;
+  ::std::unordered_map<::std::string, ::std::uint64_t> interned_;
+  ::std::vector<Level> stack_;
+  snapshot::Node root_{};
+  bool see_root_ = false;
+
+ public:
+  SnapshotWriter() = default;
+
+  /**
+   * @brief serializes value into out
+   */
+  static bool Write(const Value &value, ::std::string *out);
+
+  /**
+   * @brief writes the image to a temporary name unique to the process and the thread and renames it
+   * over path, so concurrent writers of the same path never interleave
+   */
+  static bool WriteFile(const Value &value, const char *path);
+
+  /**
+   * @brief assembles the image once the root value is complete
+   */
+  bool Finish(::std::string *out);
+
+  // handler, a table record is laid out for the exact number of members
+  static constexpr bool kExactTableSize = true;
+  bool Nil();
+  bool Bool(bool b);
+  bool Integer(LUA_INTEGER i);
+  bool Number(LUA_NUMBER n);
+  bool String(::std::string_view str);
+  bool Key(LUA_INTEGER i);
+  bool Key(::std::string_view str);
+  bool StartTable();
+  bool StartTable(::std::size_t narr, ::std::size_t nrec);
+  bool EndTable();
+  bool StartArray(::std::size_t length);
+  bool EndArray();
+
+ private:
+  bool Add(const snapshot::Node &node);
+  bool AddKey(const snapshot::Node &node, ::std::uint32_t hash);
+  bool MakeString(::std::string_view str, snapshot::Node *node);
+  ::std::uint64_t Reserve(::std::size_t size);
+  void Put(::std::uint64_t offset, const snapshot::Node &node);
+  void BuildIndex(const Level &level);
+
+  static ::std::uint64_t Align(::std::uint64_t size) { return (size + 7) & ~static_cast<::std::uint64_t>(7); }
+  static ::std::uint32_t Capacity(::std::size_t size);
+};
+
+class SnapshotView;
+
+struct SnapshotMember;
+
+/**
+ * @brief read-only value over a snapshot, with the accessors of Value, a view is three pointers
+ * and is only valid while the snapshot it was taken from is alive
+ */
+class SnapshotView {
+ public:
+  class MemberIterator {
+   private:
+    const snapshot::Member *member_;
+    const char *tables_;
+    const char *strings_;
+
+   public:
+    MemberIterator(const snapshot::Member *member, const char *tables, const char *strings)
+        : member_(member), tables_(tables), strings_(strings) {}
+
+    SnapshotMember operator*() const;
+    MemberIterator &operator++() {
+      ++member_;
+      return *this;
+    }
+    bool operator==(const MemberIterator &rhs) const { return member_ == rhs.member_; }
+    bool operator!=(const MemberIterator &rhs) const { return member_ != rhs.member_; }
+  };
+
+ private:
+  const snapshot::Node *node_;
+  const char *tables_;
+  const char *strings_;
+
+ public:
+  SnapshotView(const snapshot::Node *node, const char *tables, const char *strings)
+      : node_(node), tables_(tables), strings_(strings) {}
+
+  [[nodiscard]] Type GetType() const { return static_cast<Type>(node_->type_); }
+  [[nodiscard]] bool IsNil() const { return GetType() == S_NIL; }
+  [[nodiscard]] bool IsBool() const { return GetType() == S_BOOL; }
+  [[nodiscard]] bool IsInteger() const { return GetType() == S_INTEGER; }
+  [[nodiscard]] bool IsNumber() const { return GetType() == S_NUMBER; }
+  [[nodiscard]] bool IsString() const { return GetType() == S_STRING; }
+  [[nodiscard]] bool IsTable() const { return GetType() == S_TABLE; }
+  [[nodiscard]] bool IsArray() const { return GetType() == S_ARRAY; }
+
+  [[nodiscard]] ::std::size_t GetSize() const;
+
+  [[nodiscard]] bool GetBool() const;
+  [[nodiscard]] LUA_INTEGER GetInteger() const;
+  [[nodiscard]] LUA_NUMBER GetNumber() const;
+  [[nodiscard]] ::std::string_view GetStringView() const;
+
+  [[nodiscard]] MemberIterator MemberBegin() const;
+  [[nodiscard]] MemberIterator MemberEnd() const;
+  [[nodiscard]] MemberIterator FindMember(::std::size_t key) const;
+  [[nodiscard]] MemberIterator FindMember(::std::string_view key) const;
+
+  /**
+   * @brief positions in a sequence are 1-based, as in Value
+   */
+  SnapshotView operator[](::std::size_t key) const;
+  SnapshotView operator[](::std::string_view key) const;
+
+  template<typename Handler>
+  bool WriteTo(Handler &handler) const;
+
+ private:
+  [[nodiscard]] ::std::uint64_t Capacity() const;
+  [[nodiscard]] const snapshot::Member *Members() const;
+  [[nodiscard]] const ::std::uint32_t *Slots() const;
+
+  template<typename Key>
+  [[nodiscard]] MemberIterator Lookup(Key key) const;
+};
+
+struct SnapshotMember {
+  SnapshotView key_;
+  SnapshotView value_;
+};
+
+/**
+ * @brief owns a snapshot image, mapped read-only from a file or held in memory, only the header is
+ * checked when it is opened, the image itself is trusted
+ */
+class Snapshot : NonCopyable {
+ private:
+  const char *data_ = nullptr;
+  ::std::size_t size_ = 0;
+  bool mapped_ = false;
+  ::std::string buffer_;
+
+ public:
+  Snapshot() = default;
+  Snapshot(Snapshot &&other) noexcept;
+  ~Snapshot() { Close(); }
+
+  /**
+   * @brief maps the file, the pages are shared by every process mapping the same file
+   */
+  error::ParseError Open(const char *path);
+  error::ParseError Load(::std::string image);
+  void Close();
+
+  [[nodiscard]] SnapshotView Root() const;
+  [[nodiscard]] ::std::size_t Size() const { return size_; }
+
+ private:
+  error::ParseError Validate();
+  [[nodiscard]] const snapshot::Header *header() const { return reinterpret_cast<const snapshot::Header *>(data_); }
+};
+
+inline bool SnapshotWriter::Write(const Value &value, ::std::string *out) {
+  SnapshotWriter writer;
+  return value.WriteTo(writer) && writer.Finish(out);
+}
+
+inline bool SnapshotWriter::WriteFile(const Value &value, const char *path) {
+  ::std::string image;
+  if (!Write(value, &image)) { return false; }
+
+  ::std::string tmp = ::std::string(path) + FileChunkCache::TempSuffix();
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (fp == nullptr) { return false; }
+  bool ok = fwrite(image.data(), 1, image.size(), fp) == image.size();
+  ok = fclose(fp) == 0 && ok;
+  // replace atomically, readers mapping the old file keep their pages
+  if (!ok || ::std::rename(tmp.c_str(), path) != 0) {
+    ::std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+inline bool SnapshotWriter::Finish(::std::string *out) {
+  if (!see_root_ || !stack_.empty()) { return false; }
+
+  snapshot::Header header{};
+  ::std::memcpy(header.magic_, snapshot::kMagic, sizeof(header.magic_));
+  header.version_ = snapshot::kVersion;
+  header.byte_order_ = snapshot::kByteOrder;
+  header.tables_offset_ = sizeof(snapshot::Header);
+  header.tables_size_ = tables_.size();
+  header.strings_offset_ = header.tables_offset_ + header.tables_size_;
+  header.strings_size_ = strings_.size();
+  header.size_ = header.strings_offset_ + header.strings_size_;
+  header.root_ = root_;
+
+  out->clear();
+  out->reserve(header.size_);
+  out->append(reinterpret_cast<const char *>(&header), sizeof(header));
+  out->append(tables_);
+  out->append(strings_);
+  return true;
+}
+
+inline bool SnapshotWriter::Nil() {
+  return Add(snapshot::Node{S_NIL, 0, 0});
+}
+
+inline bool SnapshotWriter::Bool(bool b) {
+  return Add(snapshot::Node{S_BOOL, 0, b ? 1u : 0u});
+}
+
+inline bool SnapshotWriter::Integer(LUA_INTEGER i) {
+  return Add(snapshot::Node{S_INTEGER, 0, static_cast<::std::uint64_t>(i)});
+}
+
+inline bool SnapshotWriter::Number(LUA_NUMBER n) {
+  static_assert(sizeof(LUA_NUMBER) <= sizeof(::std::uint64_t), "number does not fit a node");
+  snapshot::Node node{S_NUMBER, 0, 0};
+  ::std::memcpy(&node.payload_, &n, sizeof(n));
+  return Add(node);
+}
+
+inline bool SnapshotWriter::String(::std::string_view str) {
+  snapshot::Node node{};
+  return MakeString(str, &node) && Add(node);
+}
+
+inline bool SnapshotWriter::Key(LUA_INTEGER i) {
+  return AddKey(snapshot::Node{S_INTEGER, 0, static_cast<::std::uint64_t>(i)}, Table::Hash(i));
+}
+
+inline bool SnapshotWriter::Key(::std::string_view str) {
+  snapshot::Node node{};
+  return MakeString(str, &node) && AddKey(node, Table::Hash(str));
+}
+
+inline bool SnapshotWriter::StartTable() {
+  // the record is laid out before its members arrive
+  return false;
+}
+
+inline bool SnapshotWriter::StartTable(::std::size_t narr, ::std::size_t nrec) {
+  auto size = narr + nrec;
+  if (size >= UINT32_MAX) { return false; }
+  auto capacity = Capacity(size);
+  auto record = Reserve(sizeof(::std::uint64_t) + size * sizeof(snapshot::Member) + capacity * sizeof(::std::uint32_t));
+  ::std::uint64_t cap = capacity;
+  ::std::memcpy(&tables_[record], &cap, sizeof(cap));
+
+  if (!Add(snapshot::Node{S_TABLE, static_cast<::std::uint32_t>(size), record})) { return false; }
+  Level level{record + sizeof(::std::uint64_t), static_cast<::std::uint32_t>(size), 0, true, false, {}};
+  if (capacity != 0) { level.hashes_.reserve(size); }
+  stack_.push_back(::std::move(level));
+  return true;
+}
+
+inline bool SnapshotWriter::EndTable() {
+  if (stack_.empty() || !stack_.back().is_table_) { return false; }
+  auto &level = stack_.back();
+  if (level.count_ != level.size_ || level.has_key_) { return false; }
+  if (!level.hashes_.empty()) { BuildIndex(level); }
+  stack_.pop_back();
+  return true;
+}
+
+inline bool SnapshotWriter::StartArray(::std::size_t length) {
+  if (length >= UINT32_MAX) { return false; }
+  auto record = Reserve(length * sizeof(snapshot::Node));
+  if (!Add(snapshot::Node{S_ARRAY, static_cast<::std::uint32_t>(length), record})) { return false; }
+  stack_.push_back(Level{record, static_cast<::std::uint32_t>(length), 0, false, false, {}});
+  return true;
+}
+
+inline bool SnapshotWriter::EndArray() {
+  if (stack_.empty() || stack_.back().is_table_ || stack_.back().count_ != stack_.back().size_) { return false; }
+  stack_.pop_back();
+  return true;
+}
+
+inline bool SnapshotWriter::Add(const snapshot::Node &node) {
+  if (stack_.empty()) {
+    if (see_root_) { return false; }
+    see_root_ = true;
+    root_ = node;
+    return true;
+  }
+
+  auto &level = stack_.back();
+  if (level.count_ == level.size_) { return false; }
+  if (level.is_table_) {
+    if (!level.has_key_) { return false; }
+    Put(level.record_ + level.count_ * sizeof(snapshot::Member) + sizeof(snapshot::Node), node);
+    level.has_key_ = false;
+  } else {
+    Put(level.record_ + level.count_ * sizeof(snapshot::Node), node);
+  }
+  ++level.count_;
+  return true;
+}
+
+inline bool SnapshotWriter::AddKey(const snapshot::Node &node, ::std::uint32_t hash) {
+  if (stack_.empty()) { return false; }
+  auto &level = stack_.back();
+  if (!level.is_table_ || level.has_key_ || level.count_ == level.size_) { return false; }
+  Put(level.record_ + level.count_ * sizeof(snapshot::Member), node);
+  level.has_key_ = true;
+  if (level.hashes_.capacity() != 0) { level.hashes_.push_back(hash); }
+  return true;
+}
+
+inline bool SnapshotWriter::MakeString(::std::string_view str, snapshot::Node *node) {
+  if (str.size() >= UINT32_MAX) { return false; }
+  node->type_ = S_STRING;
+  node->size_ = static_cast<::std::uint32_t>(str.size());
+
+  // keys and short values repeat a lot, store them once
+  bool intern = str.size() <= kInternMaxLength;
+  if (intern) {
+    if (auto it = interned_.find(::std::string(str)); it != interned_.end()) {
+      node->payload_ = it->second;
+      return true;
+    }
+  }
+
+  node->payload_ = strings_.size();
+  strings_.append(str.data(), str.size());
+  strings_.push_back('\0');
+  if (intern) { interned_.emplace(str, node->payload_); }
+  return true;
+}
+
+inline ::std::uint64_t SnapshotWriter::Reserve(::std::size_t size) {
+  auto offset = tables_.size();
+  tables_.resize(Align(offset + size), '\0');
+  return offset;
+}
+
+inline void SnapshotWriter::Put(::std::uint64_t offset, const snapshot::Node &node) {
+  ::std::memcpy(&tables_[offset], &node, sizeof(node));
+}
+
+inline void SnapshotWriter::BuildIndex(const Level &level) {
+  auto capacity = Capacity(level.size_);
+  auto mask = capacity - 1;
+  auto slots = level.record_ + level.size_ * sizeof(snapshot::Member);
+  for (::std::uint32_t pos = 0; pos < level.size_; ++pos) {
+    auto i = level.hashes_[pos] & mask;
+    for (::std::uint32_t slot;; i = (i + 1) & mask) {
+      ::std::memcpy(&slot, &tables_[slots + i * sizeof(slot)], sizeof(slot));
+      if (slot == 0) { break; }
+    }
+    ::std::uint32_t slot = pos + 1;
+    ::std::memcpy(&tables_[slots + i * sizeof(slot)], &slot, sizeof(slot));
+  }
+}
+
+inline ::std::uint32_t SnapshotWriter::Capacity(::std::size_t size) {
+  if (size < Table::kIndexThreshold) { return 0; }
+  ::std::uint32_t capacity = Table::kIndexThreshold;
+  while (capacity < size * 2) { capacity <<= 1; }
+  return capacity;
+}
+
+inline SnapshotMember SnapshotView::MemberIterator::operator*() const {
+  return {SnapshotView(&member_->key_, tables_, strings_), SnapshotView(&member_->value_, tables_, strings_)};
+}
+
+inline ::std::size_t SnapshotView::GetSize() const {
+  switch (GetType()) {
+    case S_TABLE:
+    case S_ARRAY: return node_->size_;
+    default: return 1;
+  }
+}
+
+inline bool SnapshotView::GetBool() const {
+  STELLA_ASSERT(IsBool());
+  return node_->payload_ != 0;
+}
+
+inline LUA_INTEGER SnapshotView::GetInteger() const {
+  STELLA_ASSERT(IsBool() || IsInteger() || IsNumber());
+  switch (GetType()) {
+    case S_BOOL:
+    case S_INTEGER: return static_cast<LUA_INTEGER>(node_->payload_);
+    case S_NUMBER: return static_cast<LUA_INTEGER>(GetNumber());
+    default: STELLA_ASSERT(false);
+  }
+  return {};
+}
+
+inline LUA_NUMBER SnapshotView::GetNumber() const {
+  STELLA_ASSERT(IsBool() || IsInteger() || IsNumber());
+  switch (GetType()) {
+    case S_BOOL:
+    case S_INTEGER: return static_cast<LUA_NUMBER>(static_cast<LUA_INTEGER>(node_->payload_));
+    case S_NUMBER: {
+      LUA_NUMBER n;
+      ::std::memcpy(&n, &node_->payload_, sizeof(n));
+      return n;
+    }
+    default: STELLA_ASSERT(false);
+  }
+  return {};
+}
+
+inline ::std::string_view SnapshotView::GetStringView() const {
+  STELLA_ASSERT(IsString());
+  return {strings_ + node_->payload_, node_->size_};
+}
+
+inline SnapshotView::MemberIterator SnapshotView::MemberBegin() const {
+  STELLA_ASSERT(IsTable());
+  return {Members(), tables_, strings_};
+}
+
+inline SnapshotView::MemberIterator SnapshotView::MemberEnd() const {
+  STELLA_ASSERT(IsTable());
+  return {Members() + node_->size_, tables_, strings_};
+}
+
+inline SnapshotView::MemberIterator SnapshotView::FindMember(::std::size_t key) const {
+  STELLA_ASSERT(IsTable());
+  return Lookup(static_cast<LUA_INTEGER>(key));
+}
+
+inline SnapshotView::MemberIterator SnapshotView::FindMember(::std::string_view key) const {
+  STELLA_ASSERT(IsTable());
+  return Lookup(key);
+}
+
+inline SnapshotView SnapshotView::operator[](::std::size_t key) const {
+  STELLA_ASSERT(IsTable() || IsArray());
+  if (IsArray()) {
+    STELLA_ASSERT(key >= 1 && key <= node_->size_ && "index out of range");
+    auto *nodes = reinterpret_cast<const snapshot::Node *>(tables_ + node_->payload_);
+    return {nodes + key - 1, tables_, strings_};
+  }
+  auto it = FindMember(key);
+  STELLA_ASSERT(it != MemberEnd() && "value not found");
+  return (*it).value_;
+}
+
+inline SnapshotView SnapshotView::operator[](::std::string_view key) const {
+  STELLA_ASSERT(IsTable());
+  auto it = FindMember(key);
+  STELLA_ASSERT(it != MemberEnd() && "value not found");
+  return (*it).value_;
+}
+
+inline ::std::uint64_t SnapshotView::Capacity() const {
+  ::std::uint64_t capacity;
+  ::std::memcpy(&capacity, tables_ + node_->payload_, sizeof(capacity));
+  return capacity;
+}
+
+inline const snapshot::Member *SnapshotView::Members() const {
+  return reinterpret_cast<const snapshot::Member *>(tables_ + node_->payload_ + sizeof(::std::uint64_t));
+}
+
+inline const ::std::uint32_t *SnapshotView::Slots() const {
+  return reinterpret_cast<const ::std::uint32_t *>(Members() + node_->size_);
+}
+
+template<typename Key>
+inline SnapshotView::MemberIterator SnapshotView::Lookup(Key key) const {
+  auto matches = [this, key](const snapshot::Member &member) -> bool {
+    if constexpr (::std::is_same_v<Key, LUA_INTEGER>) {
+      return member.key_.type_ == S_INTEGER && static_cast<LUA_INTEGER>(member.key_.payload_) == key;
+    } else {
+      return member.key_.type_ == S_STRING && member.key_.size_ == key.size()
+          && ::std::memcmp(strings_ + member.key_.payload_, key.data(), key.size()) == 0;
+    }
+  };
+
+  auto *members = Members();
+  auto capacity = Capacity();
+  if (capacity == 0) {
+    for (::std::uint32_t pos = 0; pos < node_->size_; ++pos) {
+      if (matches(members[pos])) { return {members + pos, tables_, strings_}; }
+    }
+    return MemberEnd();
+  }
+
+  auto *slots = Slots();
+  auto mask = capacity - 1;
+  for (auto i = Table::Hash(key) & mask;; i = (i + 1) & mask) {
+    if (slots[i] == 0) { return MemberEnd(); }
+    if (matches(members[slots[i] - 1])) { return {members + slots[i] - 1, tables_, strings_}; }
+  }
+}
+
+#define CALL_HANDLER(expr) do { if (!(expr)) { return false; } } while(false)
+
+template<typename Handler>
+inline bool SnapshotView::WriteTo(Handler &handler) const {
+  switch (GetType()) {
+    case S_NIL: CALL_HANDLER(handler.Nil());
+      break;
+    case S_BOOL: CALL_HANDLER(handler.Bool(GetBool()));
+      break;
+    case S_INTEGER: CALL_HANDLER(handler.Integer(GetInteger()));
+      break;
+    case S_NUMBER: CALL_HANDLER(handler.Number(GetNumber()));
+      break;
+    case S_STRING: CALL_HANDLER(handler.String(GetStringView()));
+      break;
+    case S_TABLE:
+      if (auto visit = handler::StartTable(handler, 0, GetSize()); visit != handler::Visit::kContinue) {
+        return visit == handler::Visit::kSkip;
+      }
+      for (auto it = MemberBegin(); it != MemberEnd(); ++it) {
+        auto member = *it;
+        CALL_HANDLER(member.key_.IsInteger()
+                         ? handler.Key(member.key_.GetInteger())
+                         : handler.Key(member.key_.GetStringView()));
+        CALL_HANDLER(member.value_.WriteTo(handler));
+      }
+      CALL_HANDLER(handler.EndTable());
+      break;
+    case S_ARRAY:
+      if constexpr (handler::has_array_v<Handler>) {
+        if (auto visit = handler::StartArray(handler, GetSize()); visit != handler::Visit::kContinue) {
+          return visit == handler::Visit::kSkip;
+        }
+        for (::std::size_t i = 1; i <= GetSize(); ++i) { CALL_HANDLER((*this)[i].WriteTo(handler)); }
+        CALL_HANDLER(handler.EndArray());
+      } else {
+        if (auto visit = handler::StartTable(handler, GetSize(), 0); visit != handler::Visit::kContinue) {
+          return visit == handler::Visit::kSkip;
+        }
+        for (::std::size_t i = 1; i <= GetSize(); ++i) {
+          CALL_HANDLER(handler.Key(static_cast<LUA_INTEGER>(i)));
+          CALL_HANDLER((*this)[i].WriteTo(handler));
+        }
+        CALL_HANDLER(handler.EndTable());
+      }
+      break;
+    default: STELLA_ASSERT(false && "bad type");
+  }
+  return true;
+}
+
+#undef CALL_HANDLER
+
+inline Snapshot::Snapshot(Snapshot &&other) noexcept
+    : data_(::std::exchange(other.data_, nullptr)),
+      size_(::std::exchange(other.size_, 0)),
+      mapped_(::std::exchange(other.mapped_, false)),
+      buffer_(::std::move(other.buffer_)) {
+  if (!mapped_ && data_ != nullptr) { data_ = buffer_.data(); }
+}
+
+inline error::ParseError Snapshot::Open(const char *path) {
+  Close();
+#if defined(_WIN32)
+  FILE *fp = fopen(path, "rb");
+  if (fp == nullptr) { return error::OPEN_FAILED; }
+  ::std::string image;
+  char buf[64 * 1024];
+  ::std::size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) { image.append(buf, n); }
+  fclose(fp);
+  return Load(::std::move(image));
+#else
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) { return error::OPEN_FAILED; }
+  struct stat st{};
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    return error::OPEN_FAILED;
+  }
+  if (st.st_size < static_cast<off_t>(sizeof(snapshot::Header))) {
+    ::close(fd);
+    return error::BAD_SNAPSHOT;
+  }
+  void *addr = ::mmap(nullptr, static_cast<::std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) { return error::OPEN_FAILED; }
+
+  data_ = static_cast<const char *>(addr);
+  size_ = static_cast<::std::size_t>(st.st_size);
+  mapped_ = true;
+  return Validate();
+#endif
+}
+
+inline error::ParseError Snapshot::Load(::std::string image) {
+  Close();
+  buffer_ = ::std::move(image);
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+  return Validate();
+}
+
+inline void Snapshot::Close() {
+#if !defined(_WIN32)
+  if (mapped_) { ::munmap(const_cast<char *>(data_), size_); }
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+  buffer_.clear();
+}
+
+inline SnapshotView Snapshot::Root() const {
+  STELLA_ASSERT(data_ != nullptr);
+  return {&header()->root_, data_ + header()->tables_offset_, data_ + header()->strings_offset_};
+}
+
+inline error::ParseError Snapshot::Validate() {
+  const auto *h = header();
+  bool ok = size_ >= sizeof(snapshot::Header)
+      && reinterpret_cast<::std::uintptr_t>(data_) % alignof(snapshot::Header) == 0
+      && ::std::memcmp(h->magic_, snapshot::kMagic, sizeof(h->magic_)) == 0
+      && h->version_ == snapshot::kVersion
+      && h->byte_order_ == snapshot::kByteOrder
+      && h->size_ == size_
+      && h->tables_offset_ == sizeof(snapshot::Header)
+      && h->tables_offset_ + h->tables_size_ == h->strings_offset_
+      && h->strings_offset_ + h->strings_size_ == h->size_;
+  if (!ok) {
+    Close();
+    return error::BAD_SNAPSHOT;
+  }
+  return error::OK;
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_SNAPSHOT_H_
@@ -6,16 +6,23 @@
 #define STELLA_INCLUDE_STELLA_STATE_H_
 
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
 #include <memory>
 #include <string>
 #include <string_view>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include "chunk_cache.h"
 #include "exception.h"
+#include "lua_allocator.h"
 #include "stella.h"
 #include "value.h"
 
@@ -23,31 +30,122 @@
 
 namespace stella {
 
+class Profiler;
+
 class State {
  private:
+  friend class Profiler;
+
   lua_State *lua_state_ = nullptr;
+  int baseline_ref_ = LUA_NOREF;
 
  public:
   State() = default;
   State(const State &other) = default;
-  State &operator=(State other);
-  State(State &&other) noexcept: lua_state_(other.lua_state_) {};
+  State &operator=(const State &other);
+  State(State &&other) noexcept: lua_state_(other.lua_state_), baseline_ref_(other.baseline_ref_) {};
   State &operator=(State &&other) noexcept;
   friend void swap(State &s1, State &s2);
 
+  /**
+   * @brief limits of one Call, a zero or default field sets no limit
+   */
+  struct Budget {
+    using Clock = ::std::chrono::steady_clock;
+
+    ::std::uint64_t instructions_ = 0;        // virtual machine instructions
+    ::std::chrono::nanoseconds timeout_{0};   // from the start of the call
+    Clock::time_point deadline_ = Clock::time_point::max();
+    ::std::size_t memory_ = 0;                // live bytes, the state must run on a LuaAllocator
+  };
+  static constexpr int kBudgetCheckPeriod = 1000; // instructions between two clock reads under a deadline
+
   void LoadFile(::std::string_view file);
   void LoadString(::std::string_view script);
-  void Call();
+
+  /**
+   * @brief same as above, the compiled chunk is taken from the cache when the source is unchanged
+   */
+  void LoadFile(::std::string_view file, ChunkCache &cache);
+  void LoadString(::std::string_view script, ChunkCache &cache);
+
+  /**
+   * @brief reads the whole file into script, for Load on a state opened on an allocator of the caller
+   * @return false if the file could not be opened or read
+   */
+  static bool ReadFile(::std::string_view file, ::std::string *script);
+  /**
+   * @brief runs the loaded chunk, failures are reported to stderr, OUT_OF_MEMORY when
+   * the allocator refused to grow, CALL_FAILED for any other error
+   */
+  error::ParseError Call();
+  /**
+   * @brief same under a budget, enforced by a count hook that raises a lua error once a limit is hit,
+   * INSTRUCTION_LIMIT or DEADLINE_EXCEEDED then, OUT_OF_MEMORY past the memory limit.
+   *
+   * an instruction limit or a deadline sets a count hook, and lua checks a count hook on every instruction,
+   * which makes a tight loop about 2.3x slower. The hook itself only runs when the limit runs out, or every
+   * kBudgetCheckPeriod instructions under a deadline to read the clock. A memory limit alone sets no hook.
+   *
+   * After the limit every instruction raises again, so a script catching the error with pcall cannot
+   * go on. A hook already set, e.g. a Profiler, still gets its events, but only C functions are not
+   * interrupted, a deadline is checked between lua instructions.
+   *
+   * a memory limit on a state that does not run on a LuaAllocator is BAD_VALUE, the chunk is popped
+   * without running.
+   */
+  error::ParseError Call(const Budget &budget);
   void Destroy();
 
+  /**
+   * @brief creates the lua state with the standard libraries and the error handler, without loading anything,
+   * the allocator, e.g. LuaAllocator::Alloc, must outlive the state
+   * @return false if the state could not be allocated
+   */
+  bool Open();
+  bool Open(lua_Alloc alloc, void *ud);
+
+  /**
+   * @brief loads a chunk onto an opened state, the chunk is left on the top for Call(),
+   * with a cache the binary chunk is loaded on a hit and the source is compiled and dumped
+   * into the cache on a miss or when the binary chunk is rejected
+   */
+  bool Load(::std::string_view script, ::std::string_view name = "=chunk", ChunkCache *cache = nullptr);
+
+  /**
+   * @brief records the current globals and loaded modules as the baseline restored by Reset()
+   */
+  void Checkpoint();
+
+  /**
+   * @brief clears the stack and restores the globals, the metatable of the global table and
+   * the loaded modules to the last checkpoint, the restore is shallow: fields written into
+   * the library tables themselves are kept
+   */
+  void Reset();
+
+  /**
+   * @brief runs a full garbage collection, or a single incremental step
+   */
+  void Collect(bool full = true);
+
   [[nodiscard]] ::std::string Version() const;
   [[nodiscard]] ::std::size_t StackSize() const;
 
+  bool CheckStack(int size);
   bool HasNext(int index);
+  ::std::size_t RawLen(int index);
+  void RawGet(int index, LUA_INTEGER n);
+  void RawGet(int index, ::std::string_view key);
   Type GetType(int index);
+  bool GetType(Type *type, int index);
   void GetGlobal(::std::string_view name);
   void PushGlobalTable();
 
+  int Ref(int index);
+  void Unref(int ref);
+  void PushRef(int ref);
+
   bool IsNil(int index);
   bool IsBool(int index);
   bool IsNumber(int index);
@@ -74,6 +172,7 @@ class State {
   bool Get(LUA_INTEGER *val, int index);
   bool Get(LUA_NUMBER *val, int index);
   bool Get(::std::string *val, int index);
+  bool Get(::std::string_view *val, int index);
 
   template<typename T>
   ::std::enable_if_t<::std::is_integral_v<T> && !::std::is_same_v<T, bool>, bool> Get(T *val, int index);
@@ -81,6 +180,21 @@ class State {
   template<typename T>
   ::std::enable_if_t<::std::is_floating_point_v<T>, bool> Get(T *val, int index);
 
+  /**
+   * @brief copies the sequence at index, 1 to its raw length, with one raw get per element, TYPE_MISMATCH
+   * when the value is not a table or an element is not a number, an integer accepts a float with an
+   * integral value
+   */
+  error::ParseError GetNumbers(::std::vector<LUA_NUMBER> *out, int index);
+  error::ParseError GetIntegers(::std::vector<LUA_INTEGER> *out, int index);
+
+  /**
+   * @brief same into a buffer of capacity elements, *length gets the length of the sequence, the
+   * elements past the capacity are neither copied nor checked
+   */
+  error::ParseError GetNumbers(LUA_NUMBER *out, ::std::size_t capacity, ::std::size_t *length, int index);
+  error::ParseError GetIntegers(LUA_INTEGER *out, ::std::size_t capacity, ::std::size_t *length, int index);
+
   bool Top(bool *val);
   bool Top(LUA_INTEGER *val);
   bool Top(LUA_NUMBER *val);
@@ -96,11 +210,40 @@ class State {
   void Pop();
 
  private:
+  struct BudgetHook {
+    static constexpr ::std::uint64_t kUnlimited = ::std::numeric_limits<::std::uint64_t>::max();
+
+    lua_Hook prev_hook_;
+    int prev_mask_;
+    int prev_count_;
+    int prev_elapsed_ = 0;           // instructions since the previous count hook last ran
+    ::std::uint64_t remaining_;
+    Budget::Clock::time_point deadline_;
+    int step_ = 0;                   // count of the hook
+    error::ParseError exceeded_ = error::OK;
+  };
+  static inline const char kBudgetKey = 0;
+
+  error::ParseError Result(int status);
+  static void Hook(lua_State *lua_state, lua_Debug *debug);
+  static int NextStep(const BudgetHook &hook);
   static int error_handling(lua_State *lua_state);
+  static int panic(lua_State *lua_state);
+  static void RestoreTable(lua_State *lua_state, int target, int baseline);
+  static int DumpWriter(lua_State *lua_state, const void *p, ::std::size_t size, void *ud);
+
+  template<typename T>
+  error::ParseError GetSequence(::std::vector<T> *out, int index);
+  template<typename T>
+  error::ParseError GetSequence(T *out, ::std::size_t capacity, ::std::size_t *length, int index);
+  template<typename T>
+  error::ParseError ReadSequence(T *out, ::std::size_t count, int index);
+  static void IntegersToNumbers(LUA_NUMBER *data, ::std::size_t count);
 };
 
-inline State &State::operator=(State other) {
-  swap(*this, other);
+inline State &State::operator=(const State &other) {
+  State tmp(other);
+  swap(*this, tmp);
   return *this;
 }
 
@@ -111,34 +254,203 @@ inline State &State::operator=(State &&other) noexcept {
 
 inline void swap(State &s1, State &s2) {
   ::std::swap(s1.lua_state_, s2.lua_state_);
-}
+  ::std::swap(s1.baseline_ref_, s2.baseline_ref_);
+}
+
+inline error::ParseError State::Call() {
+  return Result(lua_pcall(lua_state_, 0, 0, 1));
+}
+
+inline error::ParseError State::Call(const Budget &budget) {
+  auto deadline = budget.deadline_;
+  if (budget.timeout_.count() > 0) { deadline = ::std::min(deadline, Budget::Clock::now() + budget.timeout_); }
+  BudgetHook hook{lua_gethook(lua_state_), lua_gethookmask(lua_state_), lua_gethookcount(lua_state_), 0,
+                  budget.instructions_ != 0 ? budget.instructions_ : BudgetHook::kUnlimited, deadline};
+
+  LuaAllocator *allocator = nullptr;
+  ::std::size_t limit = 0;
+  if (budget.memory_ != 0) {
+    void *ud = nullptr;
+    // ud is only a LuaAllocator when the state runs on one, e.g. it is nullptr for luaL_newstate
+    if (lua_getallocf(lua_state_, &ud) != LuaAllocator::Alloc) {
+      lua_pop(lua_state_, 1);
+      return error::BAD_VALUE;
+    }
+    allocator = static_cast<LuaAllocator *>(ud);
+    limit = allocator->Limit();
+    allocator->SetLimit(limit != 0 ? ::std::min(limit, budget.memory_) : budget.memory_);
+  }
 
-inline void State::Call() {
-  if (auto status = lua_pcall(lua_state_, 0, 0, 1); status != LUA_OK) {
-    fprintf(stderr, "error code:%d, msg:%s\n", status, lua_tostring(lua_state_, -1));
+  // the count hook slows down every instruction, it is left out when there is nothing to count
+  bool hooked = hook.remaining_ != BudgetHook::kUnlimited || deadline != Budget::Clock::time_point::max();
+  if (hooked) {
+    lua_pushlightuserdata(lua_state_, &hook);
+    lua_rawsetp(lua_state_, LUA_REGISTRYINDEX, &kBudgetKey);
+    hook.step_ = NextStep(hook);
+    lua_sethook(lua_state_, Hook, hook.prev_mask_ | LUA_MASKCOUNT, hook.step_);
   }
+
+  auto status = lua_pcall(lua_state_, 0, 0, 1);
+
+  if (hooked) {
+    lua_sethook(lua_state_, hook.prev_hook_, hook.prev_mask_, hook.prev_count_);
+    lua_pushnil(lua_state_);
+    lua_rawsetp(lua_state_, LUA_REGISTRYINDEX, &kBudgetKey);
+  }
+  if (allocator != nullptr) { allocator->SetLimit(limit); }
+
+  auto err = Result(status);
+  return hook.exceeded_ != error::OK ? hook.exceeded_ : err;
+}
+
+inline error::ParseError State::Result(int status) {
+  if (status == LUA_OK) { return error::OK; }
+  fprintf(stderr, "error code:%d, msg:%s\n", status, lua_tostring(lua_state_, -1));
+  lua_pop(lua_state_, 1);
+  return status == LUA_ERRMEM ? error::OUT_OF_MEMORY : error::CALL_FAILED;
 }
 
 inline void State::LoadFile(::std::string_view file) {
-  STELLA_ASSERT(lua_state_ == nullptr && "lua state not closed");
-  lua_state_ = luaL_newstate();
-  luaL_openlibs(lua_state_);
-  lua_pushcfunction(lua_state_, error_handling);
+  Open();
   luaL_loadfile(lua_state_, file.data());
 }
 
 inline void State::LoadString(::std::string_view script) {
-  STELLA_ASSERT(lua_state_ == nullptr && "lua state not closed");
-  lua_state_ = luaL_newstate();
-  luaL_openlibs(lua_state_);
-  lua_pushcfunction(lua_state_, error_handling);
+  Open();
   luaL_loadstring(lua_state_, script.data());
 }
 
+inline void State::LoadFile(::std::string_view file, ChunkCache &cache) {
+  ::std::string script;
+  if (ReadFile(file, &script)) {
+    Open();
+    Load(script, "@" + ::std::string(file), &cache);
+    return;
+  }
+  // let lua report the error
+  LoadFile(file);
+}
+
+inline void State::LoadString(::std::string_view script, ChunkCache &cache) {
+  Open();
+  // lua only shows the beginning of a chunk named by its source
+  Load(script, script.substr(0, 64), &cache);
+}
+
+inline bool State::ReadFile(::std::string_view file, ::std::string *script) {
+  ::std::string path(file);
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp == nullptr) { return false; }
+  char buf[64 * 1024];
+  ::std::size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) { script->append(buf, n); }
+  bool failed = ferror(fp) != 0;
+  fclose(fp);
+  return !failed;
+}
+
 inline void State::Destroy() {
   STELLA_ASSERT(lua_state_ != nullptr && "lua state already closed");
   lua_close(lua_state_);
   lua_state_ = nullptr;
+  baseline_ref_ = LUA_NOREF;
+}
+
+inline bool State::Open() {
+  STELLA_ASSERT(lua_state_ == nullptr && "lua state not closed");
+  lua_state_ = luaL_newstate();
+  if (lua_state_ == nullptr) { return false; }
+  luaL_openlibs(lua_state_);
+  lua_pushcfunction(lua_state_, error_handling);
+  return true;
+}
+
+inline bool State::Open(lua_Alloc alloc, void *ud) {
+  STELLA_ASSERT(lua_state_ == nullptr && "lua state not closed");
+  lua_state_ = lua_newstate(alloc, ud);
+  if (lua_state_ == nullptr) { return false; }
+  lua_atpanic(lua_state_, panic);
+  luaL_openlibs(lua_state_);
+  lua_pushcfunction(lua_state_, error_handling);
+  return true;
+}
+
+inline bool State::Load(::std::string_view script, ::std::string_view name, ChunkCache *cache) {
+  STELLA_ASSERT(lua_state_ != nullptr && "lua state not opened");
+  ::std::string chunk_name(name);
+
+  ChunkKey key{};
+  if (cache != nullptr) {
+    key = ChunkKey::Of(script);
+    if (auto chunk = cache->Get(key)) {
+      if (luaL_loadbufferx(lua_state_, chunk->data(), chunk->size(), chunk_name.c_str(), "b") == LUA_OK) {
+        return true;
+      }
+      // truncated or foreign chunk, recompile and overwrite it
+      lua_pop(lua_state_, 1);
+    }
+  }
+
+  auto status = luaL_loadbufferx(lua_state_, script.data(), script.size(), chunk_name.c_str(), nullptr);
+  if (status != LUA_OK) {
+    fprintf(stderr, "error code:%d, msg:%s\n", status, lua_tostring(lua_state_, -1));
+    lua_pop(lua_state_, 1);
+    return false;
+  }
+
+  if (cache != nullptr) {
+    ::std::string chunk;
+    if (lua_dump(lua_state_, DumpWriter, &chunk, 0) == 0) { cache->Put(key, ::std::move(chunk)); }
+  }
+  return true;
+}
+
+// the baseline is a registry table { globals, loaded modules, metatable of the globals }
+inline void State::Checkpoint() {
+  STELLA_ASSERT(lua_state_ != nullptr && "lua state not opened");
+  if (baseline_ref_ != LUA_NOREF) { luaL_unref(lua_state_, LUA_REGISTRYINDEX, baseline_ref_); }
+
+  lua_createtable(lua_state_, 3, 0);
+  int baseline = lua_gettop(lua_state_);
+
+  lua_pushglobaltable(lua_state_);
+  lua_getfield(lua_state_, LUA_REGISTRYINDEX, "_LOADED");
+  for (int i = 1; i <= 2; ++i) {
+    lua_newtable(lua_state_);
+    lua_pushnil(lua_state_);
+    while (lua_next(lua_state_, baseline + i)) {
+      lua_pushvalue(lua_state_, -2);
+      lua_insert(lua_state_, -2);
+      lua_rawset(lua_state_, -4);
+    }
+    lua_rawseti(lua_state_, baseline, i);
+  }
+  if (!lua_getmetatable(lua_state_, baseline + 1)) { lua_pushnil(lua_state_); }
+  lua_rawseti(lua_state_, baseline, 3);
+  lua_pop(lua_state_, 2);
+
+  baseline_ref_ = luaL_ref(lua_state_, LUA_REGISTRYINDEX);
+}
+
+inline void State::Reset() {
+  STELLA_ASSERT(lua_state_ != nullptr && "lua state not opened");
+  STELLA_ASSERT(baseline_ref_ != LUA_NOREF && "no checkpoint");
+
+  // keep the error handler at the bottom
+  lua_settop(lua_state_, 1);
+  lua_rawgeti(lua_state_, LUA_REGISTRYINDEX, baseline_ref_);
+
+  lua_pushglobaltable(lua_state_);
+  lua_rawgeti(lua_state_, 2, 1);
+  RestoreTable(lua_state_, 3, 4);
+  lua_rawgeti(lua_state_, 2, 3);
+  lua_setmetatable(lua_state_, 3);
+  lua_settop(lua_state_, 2);
+
+  lua_getfield(lua_state_, LUA_REGISTRYINDEX, "_LOADED");
+  lua_rawgeti(lua_state_, 2, 2);
+  RestoreTable(lua_state_, 3, 4);
+  lua_settop(lua_state_, 1);
 }
 
 inline ::std::string State::Version() const {
@@ -153,10 +465,28 @@ inline ::std::size_t State::StackSize() const {
   return lua_gettop(lua_state_);
 }
 
+inline bool State::CheckStack(int size) {
+  return lua_checkstack(lua_state_, size);
+}
+
 inline bool State::HasNext(int index) {
   return lua_next(lua_state_, index);
 }
 
+inline ::std::size_t State::RawLen(int index) {
+  return static_cast<::std::size_t>(lua_rawlen(lua_state_, index));
+}
+
+inline void State::RawGet(int index, LUA_INTEGER n) {
+  lua_rawgeti(lua_state_, index, n);
+}
+
+inline void State::RawGet(int index, ::std::string_view key) {
+  index = lua_absindex(lua_state_, index);
+  lua_pushlstring(lua_state_, key.data(), key.size());
+  lua_rawget(lua_state_, index);
+}
+
 inline Type State::GetType(int index) {
   switch (lua_type(lua_state_, index)) {
     case LUA_TNIL:return S_NIL;
@@ -168,6 +498,22 @@ inline Type State::GetType(int index) {
   }
 }
 
+inline bool State::GetType(Type *type, int index) {
+  switch (lua_type(lua_state_, index)) {
+    case LUA_TNIL: *type = S_NIL;
+      return true;
+    case LUA_TBOOLEAN: *type = S_BOOL;
+      return true;
+    case LUA_TNUMBER: *type = S_NUMBER;
+      return true;
+    case LUA_TSTRING: *type = S_STRING;
+      return true;
+    case LUA_TTABLE: *type = S_TABLE;
+      return true;
+    default: return false;
+  }
+}
+
 inline void State::GetGlobal(::std::string_view name) {
   lua_getglobal(lua_state_, ::std::string(name).c_str());
 }
@@ -176,6 +522,19 @@ inline void State::PushGlobalTable() {
   lua_pushglobaltable(lua_state_);
 }
 
+inline int State::Ref(int index) {
+  lua_pushvalue(lua_state_, index);
+  return luaL_ref(lua_state_, LUA_REGISTRYINDEX);
+}
+
+inline void State::Unref(int ref) {
+  luaL_unref(lua_state_, LUA_REGISTRYINDEX, ref);
+}
+
+inline void State::PushRef(int ref) {
+  lua_rawgeti(lua_state_, LUA_REGISTRYINDEX, ref);
+}
+
 inline bool State::IsNil(int index) {
   return lua_isnil(lua_state_, index);
 }
@@ -275,6 +634,17 @@ inline bool State::Get(std::string *val, int index) {
   return false;
 }
 
+inline bool State::Get(::std::string_view *val, int index) {
+  // only real strings, lua_tolstring would convert a number in place
+  if (lua_type(lua_state_, index) == LUA_TSTRING) {
+    ::std::size_t len = 0;
+    const char *str = lua_tolstring(lua_state_, index, &len);
+    *val = ::std::string_view(str, len);
+    return true;
+  }
+  return false;
+}
+
 template<typename T>
 inline ::std::enable_if_t<::std::is_integral_v<T> && !::std::is_same_v<T, bool>, bool> State::Get(T *val, int index) {
   if (lua_isinteger(lua_state_, index)) {
@@ -319,6 +689,124 @@ inline ::std::enable_if_t<::std::is_floating_point_v<T>, bool> State::Top(T *val
   return Get(val, -1);
 }
 
+inline error::ParseError State::GetNumbers(::std::vector<LUA_NUMBER> *out, int index) {
+  return GetSequence(out, index);
+}
+
+inline error::ParseError State::GetIntegers(::std::vector<LUA_INTEGER> *out, int index) {
+  return GetSequence(out, index);
+}
+
+inline error::ParseError State::GetNumbers(LUA_NUMBER *out, ::std::size_t capacity, ::std::size_t *length,
+                                           int index) {
+  return GetSequence(out, capacity, length, index);
+}
+
+inline error::ParseError State::GetIntegers(LUA_INTEGER *out, ::std::size_t capacity, ::std::size_t *length,
+                                            int index) {
+  return GetSequence(out, capacity, length, index);
+}
+
+template<typename T>
+inline error::ParseError State::GetSequence(::std::vector<T> *out, int index) {
+  if (!lua_istable(lua_state_, index)) { return error::TYPE_MISMATCH; }
+  out->resize(RawLen(index));
+  auto err = ReadSequence(out->data(), out->size(), index);
+  if (err != error::OK) { out->clear(); }
+  return err;
+}
+
+template<typename T>
+inline error::ParseError State::GetSequence(T *out, ::std::size_t capacity, ::std::size_t *length, int index) {
+  if (!lua_istable(lua_state_, index)) { return error::TYPE_MISMATCH; }
+  *length = RawLen(index);
+  return ReadSequence(out, ::std::min(capacity, *length), index);
+}
+
+/**
+ * @brief the type returned by the raw get is the type check, a leading run of integers is read without
+ * converting anything, numbers get it converted in one pass afterwards
+ */
+template<typename T>
+inline error::ParseError State::ReadSequence(T *out, ::std::size_t count, int index) {
+  static_assert(::std::is_same_v<T, LUA_NUMBER> || ::std::is_same_v<T, LUA_INTEGER>);
+  if (!lua_checkstack(lua_state_, 1)) { return error::STACK_OVERFLOW; }
+  index = lua_absindex(lua_state_, index);
+
+  ::std::size_t i = 0;
+  constexpr bool kStage = ::std::is_same_v<T, LUA_INTEGER> || sizeof(LUA_INTEGER) == sizeof(LUA_NUMBER);
+  if constexpr (kStage) {
+    for (; i < count; ++i) {
+      if (lua_rawgeti(lua_state_, index, static_cast<lua_Integer>(i + 1)) != LUA_TNUMBER
+          || !lua_isinteger(lua_state_, -1)) {
+        lua_pop(lua_state_, 1);
+        break;
+      }
+      auto integer = static_cast<LUA_INTEGER>(lua_tointeger(lua_state_, -1));
+      ::std::memcpy(out + i, &integer, sizeof(integer));
+      lua_pop(lua_state_, 1);
+    }
+    if constexpr (::std::is_same_v<T, LUA_NUMBER>) { IntegersToNumbers(out, i); }
+  }
+
+  for (; i < count; ++i) {
+    if (lua_rawgeti(lua_state_, index, static_cast<lua_Integer>(i + 1)) != LUA_TNUMBER) {
+      lua_pop(lua_state_, 1);
+      return error::TYPE_MISMATCH;
+    }
+    if constexpr (::std::is_same_v<T, LUA_NUMBER>) {
+      out[i] = static_cast<LUA_NUMBER>(lua_tonumber(lua_state_, -1));
+    } else {
+      int is_integer = 0;
+      out[i] = static_cast<LUA_INTEGER>(lua_tointegerx(lua_state_, -1, &is_integer));
+      if (!is_integer) {
+        lua_pop(lua_state_, 1);
+        return error::TYPE_MISMATCH;
+      }
+    }
+    lua_pop(lua_state_, 1);
+  }
+  return error::OK;
+}
+
+/**
+ * @brief converts in place the integers staged in the storage of the numbers, integers below 2^51 in
+ * magnitude are added to the bits of 1.5 * 2^52 and the bias is subtracted, which needs neither a branch
+ * nor a 64-bit conversion instruction, so the loops vectorize
+ */
+inline void State::IntegersToNumbers(LUA_NUMBER *data, ::std::size_t count) {
+  if constexpr (::std::is_same_v<LUA_NUMBER, double> && sizeof(LUA_INTEGER) == sizeof(double)) {
+    constexpr ::std::uint64_t kBias = 0x4338000000000000ULL;
+    constexpr double kOffset = 6755399441055744.0;  // 1.5 * 2^52
+
+    // any bit above the 52nd once shifted into [0, 2^52) marks an integer out of range
+    ::std::uint64_t high = 0;
+    for (::std::size_t i = 0; i < count; ++i) {
+      ::std::uint64_t bits;
+      ::std::memcpy(&bits, data + i, sizeof(bits));
+      high |= (bits + (1ULL << 51)) >> 52;
+    }
+
+    if (high == 0) {
+      for (::std::size_t i = 0; i < count; ++i) {
+        ::std::uint64_t bits;
+        ::std::memcpy(&bits, data + i, sizeof(bits));
+        bits += kBias;
+        double number;
+        ::std::memcpy(&number, &bits, sizeof(number));
+        data[i] = number - kOffset;
+      }
+      return;
+    }
+  }
+
+  for (::std::size_t i = 0; i < count; ++i) {
+    LUA_INTEGER integer;
+    ::std::memcpy(&integer, data + i, sizeof(integer));
+    data[i] = static_cast<LUA_NUMBER>(integer);
+  }
+}
+
 inline void State::Pop(::std::size_t size) {
   lua_pop(lua_state_, size);
 }
@@ -327,15 +815,116 @@ inline void State::Pop() {
   Pop(1);
 }
 
+inline void State::Collect(bool full) {
+  lua_gc(lua_state_, full ? LUA_GCCOLLECT : LUA_GCSTEP, 0);
+}
+
+/**
+ * @brief makes the table at target a shallow copy of the table at baseline, both absolute indices,
+ * existing fields may be assigned or cleared while traversing, new fields are added by a second pass
+ */
+inline void State::RestoreTable(lua_State *lua_state, int target, int baseline) {
+  lua_pushnil(lua_state);
+  while (lua_next(lua_state, target)) {
+    lua_pushvalue(lua_state, -2);
+    lua_rawget(lua_state, baseline);
+    if (!lua_rawequal(lua_state, -1, -2)) {
+      lua_pushvalue(lua_state, -3);
+      lua_insert(lua_state, -2);
+      lua_rawset(lua_state, target);
+    } else {
+      lua_pop(lua_state, 1);
+    }
+    lua_pop(lua_state, 1);
+  }
+
+  lua_pushnil(lua_state);
+  while (lua_next(lua_state, baseline)) {
+    lua_pushvalue(lua_state, -2);
+    lua_rawget(lua_state, target);
+    if (lua_isnil(lua_state, -1)) {
+      lua_pop(lua_state, 1);
+      lua_pushvalue(lua_state, -2);
+      lua_insert(lua_state, -2);
+      lua_rawset(lua_state, target);
+    } else {
+      lua_pop(lua_state, 2);
+    }
+  }
+}
+
+inline int State::DumpWriter(lua_State *lua_state, const void *p, ::std::size_t size, void *ud) {
+  (void) lua_state;
+  static_cast<::std::string *>(ud)->append(static_cast<const char *>(p), size);
+  return 0;
+}
+
+/**
+ * @brief the count events are spaced by step_ instructions, never more than the budget left or
+ * than the instructions to the next event of the previous count hook, so both are met exactly
+ */
+inline void State::Hook(lua_State *lua_state, lua_Debug *debug) {
+  lua_rawgetp(lua_state, LUA_REGISTRYINDEX, &kBudgetKey);
+  auto *hook = static_cast<BudgetHook *>(lua_touserdata(lua_state, -1));
+  lua_pop(lua_state, 1);
+  if (hook == nullptr) { return; }
+
+  bool forward = debug->event != LUA_HOOKCOUNT;
+  if (!forward && hook->exceeded_ == error::OK) {
+    if (hook->prev_mask_ & LUA_MASKCOUNT) {
+      hook->prev_elapsed_ += hook->step_;
+      if (hook->prev_elapsed_ >= hook->prev_count_) {
+        hook->prev_elapsed_ = 0;
+        forward = true;
+      }
+    }
+    if (hook->remaining_ != BudgetHook::kUnlimited) {
+      hook->remaining_ -= static_cast<::std::uint64_t>(hook->step_);
+      if (hook->remaining_ == 0) { hook->exceeded_ = error::INSTRUCTION_LIMIT; }
+    }
+    if (hook->exceeded_ == error::OK && hook->deadline_ != Budget::Clock::time_point::max()
+        && Budget::Clock::now() >= hook->deadline_) {
+      hook->exceeded_ = error::DEADLINE_EXCEEDED;
+    }
+  }
+  if (forward && hook->prev_hook_ != nullptr) { hook->prev_hook_(lua_state, debug); }
+
+  if (debug->event != LUA_HOOKCOUNT) { return; }
+  auto step = hook->exceeded_ != error::OK ? 1 : NextStep(*hook);
+  if (step != hook->step_) {
+    hook->step_ = step;
+    lua_sethook(lua_state, Hook, hook->prev_mask_ | LUA_MASKCOUNT, step);
+  }
+  if (hook->exceeded_ != error::OK) { luaL_error(lua_state, "%s", ParseErrorStr(hook->exceeded_)); }
+}
+
+inline int State::NextStep(const BudgetHook &hook) {
+  ::std::uint64_t step = ::std::numeric_limits<int>::max();
+  if (hook.deadline_ != Budget::Clock::time_point::max()) { step = kBudgetCheckPeriod; }
+  step = ::std::min(step, hook.remaining_);
+  if (hook.prev_mask_ & LUA_MASKCOUNT) {
+    step = ::std::min(step, static_cast<::std::uint64_t>(hook.prev_count_ - hook.prev_elapsed_));
+  }
+  return static_cast<int>(::std::max(step, ::std::uint64_t{1}));
+}
+
+// same as the panic function installed by luaL_newstate
+inline int State::panic(lua_State *lua_state) {
+  fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(lua_state, -1));
+  return 0;
+}
+
 inline int State::error_handling(lua_State *lua_state) {
   fprintf(stderr, "error: %s\n", lua_tostring(lua_state, -1));
   lua_pop(lua_state, 1);
 
-  lua_Debug debug;
+  // lua_getstack only selects the frame, lua_getinfo fills the fields read below
+  lua_Debug debug{};
   int level = 0;
   ::std::string ret;
 
   while (lua_getstack(lua_state, level, &debug)) {
+    lua_getinfo(lua_state, "Sln", &debug);
     auto len = ::std::snprintf(nullptr, 0,
                                "\tat %s:%d in function '%s'\n", debug.short_src, debug.currentline, debug.name);
     auto buf = ::std::make_unique<char[]>(len + 1);
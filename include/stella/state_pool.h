@@ -0,0 +1,217 @@
+//
+// Created by Homin Su on 2023/6/17.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_STATE_POOL_H_
+#define STELLA_INCLUDE_STELLA_STATE_POOL_H_
+
+#include <cstddef>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "non_copyable.h"
+#include "state.h"
+#include "stella.h"
+
+namespace stella {
+
+/**
+ * @brief hands out opened states with the standard libraries loaded and gets them back reset to
+ * their baseline, so the cost of luaL_newstate / luaL_openlibs is paid once per state instead of
+ * once per evaluation.
+ *
+ * the free states are spread over shards, every thread has a home shard picked round-robin on its
+ * first checkout and returns the states there, so threads do not contend on a single lock, a
+ * thread whose shard is empty steals from the others before creating a new state.
+ *
+ * a state must not be used by two threads at once, documents parsed with kParseBorrowStringsFlag
+ * must be destroyed before their state is released.
+ */
+class StatePool : NonCopyable {
+ public:
+  struct Options {
+    ::std::size_t shards_ = 0;           // 0 for one shard per hardware thread
+    ::std::size_t initial_states_ = 0;   // states created up front, spread over the shards
+    ::std::size_t max_states_ = 0;       // 0 for unbounded, otherwise checkouts wait for a release
+    bool collect_on_release_ = false;    // run a full collection on release instead of a single step
+    ::std::function<void(State &)> init_; // runs on every new state before its baseline is recorded
+  };
+
+  class Handle : NonCopyable {
+   private:
+    friend class StatePool;
+
+    StatePool *pool_ = nullptr;
+    State state_;
+    ::std::size_t shard_ = 0;
+
+    Handle(StatePool *pool, State &&state, ::std::size_t shard)
+        : pool_(pool), state_(::std::move(state)), shard_(shard) {}
+
+   public:
+    Handle() = default;
+    Handle(Handle &&other) noexcept;
+    Handle &operator=(Handle &&other) noexcept;
+    ~Handle() { Release(); }
+
+    State &operator*() { return state_; }
+    State *operator->() { return &state_; }
+    explicit operator bool() const { return pool_ != nullptr; }
+
+    /**
+     * @brief resets the state and gives it back to the pool, done by the destructor as well
+     */
+    void Release();
+  };
+
+  explicit StatePool(Options options);
+  StatePool() : StatePool(Options()) {}
+  ~StatePool();
+
+  Handle Acquire();
+
+  [[nodiscard]] ::std::size_t Created() const { return created_.load(::std::memory_order_relaxed); }
+
+ private:
+  struct alignas(64) Shard {
+    ::std::mutex mutex_;
+    ::std::vector<State> free_;
+  };
+
+  Options options_;
+  ::std::size_t num_shards_;
+  ::std::unique_ptr<Shard[]> shards_;
+  ::std::atomic<::std::size_t> created_{0};
+
+  // slow path when max_states_ is reached
+  ::std::mutex wait_mutex_;
+  ::std::condition_variable available_;
+  ::std::atomic<::std::size_t> waiters_{0};
+
+  [[nodiscard]] ::std::size_t HomeShard() const;
+  bool TryTake(::std::size_t home, State *state, bool wait);
+  bool TryReserve();
+  State Create();
+  void Release(State &&state, ::std::size_t shard);
+};
+
+inline StatePool::Handle::Handle(Handle &&other) noexcept
+    : pool_(other.pool_), state_(::std::move(other.state_)), shard_(other.shard_) {
+  other.pool_ = nullptr;
+}
+
+inline StatePool::Handle &StatePool::Handle::operator=(Handle &&other) noexcept {
+  if (this != &other) {
+    Release();
+    pool_ = other.pool_;
+    state_ = ::std::move(other.state_);
+    shard_ = other.shard_;
+    other.pool_ = nullptr;
+  }
+  return *this;
+}
+
+inline void StatePool::Handle::Release() {
+  if (pool_ == nullptr) { return; }
+  pool_->Release(::std::move(state_), shard_);
+  state_ = State();
+  pool_ = nullptr;
+}
+
+inline StatePool::StatePool(Options options)
+    : options_(::std::move(options)),
+      num_shards_(options_.shards_ != 0 ? options_.shards_ : ::std::max(1u, ::std::thread::hardware_concurrency())),
+      shards_(::std::make_unique<Shard[]>(num_shards_)) {
+  for (::std::size_t i = 0; i < options_.initial_states_ && TryReserve(); ++i) {
+    shards_[i % num_shards_].free_.push_back(Create());
+  }
+}
+
+inline StatePool::~StatePool() {
+  for (::std::size_t i = 0; i < num_shards_; ++i) {
+    for (auto &state : shards_[i].free_) { state.Destroy(); }
+  }
+}
+
+inline StatePool::Handle StatePool::Acquire() {
+  auto home = HomeShard();
+  State state;
+  if (TryTake(home, &state, false)) { return {this, ::std::move(state), home}; }
+  if (TryReserve()) { return {this, Create(), home}; }
+
+  ::std::unique_lock<::std::mutex> lock(wait_mutex_);
+  waiters_.fetch_add(1);
+  while (!TryTake(home, &state, true)) { available_.wait(lock); }
+  waiters_.fetch_sub(1);
+  return {this, ::std::move(state), home};
+}
+
+inline ::std::size_t StatePool::HomeShard() const {
+  static ::std::atomic<::std::size_t> next{0};
+  thread_local ::std::size_t index = next.fetch_add(1, ::std::memory_order_relaxed);
+  return index % num_shards_;
+}
+
+/**
+ * @brief pops a free state, from the home shard first, the other shards are skipped when their lock
+ * is busy unless wait is set, the slow path must not miss a state released while it is scanning
+ */
+inline bool StatePool::TryTake(::std::size_t home, State *state, bool wait) {
+  for (::std::size_t i = 0; i < num_shards_; ++i) {
+    auto &shard = shards_[(home + i) % num_shards_];
+    ::std::unique_lock<::std::mutex> lock(shard.mutex_, ::std::defer_lock);
+    if (i == 0 || wait) { lock.lock(); }
+    else if (!lock.try_lock()) { continue; }
+    if (!shard.free_.empty()) {
+      *state = ::std::move(shard.free_.back());
+      shard.free_.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool StatePool::TryReserve() {
+  if (options_.max_states_ == 0) {
+    created_.fetch_add(1, ::std::memory_order_relaxed);
+    return true;
+  }
+  auto created = created_.load(::std::memory_order_relaxed);
+  while (created < options_.max_states_) {
+    if (created_.compare_exchange_weak(created, created + 1, ::std::memory_order_relaxed)) { return true; }
+  }
+  return false;
+}
+
+inline State StatePool::Create() {
+  State state;
+  state.Open();
+  if (options_.init_) { options_.init_(state); }
+  state.Checkpoint();
+  return state;
+}
+
+inline void StatePool::Release(State &&state, ::std::size_t shard) {
+  state.Reset();
+  state.Collect(options_.collect_on_release_);
+  {
+    ::std::lock_guard<::std::mutex> lock(shards_[shard].mutex_);
+    shards_[shard].free_.push_back(::std::move(state));
+  }
+  if (waiters_.load() != 0) {
+    ::std::lock_guard<::std::mutex> lock(wait_mutex_);
+    available_.notify_one();
+  }
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_STATE_POOL_H_
@@ -6,15 +6,21 @@
 #define STELLA_INCLUDE_STELLA_VALUE_H_
 
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 
 #include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <string_view>
-#include <variant>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "allocator.h"
+#include "handler.h"
 #include "stella.h"
 
 #include <lua.hpp>
@@ -23,16 +29,149 @@ namespace stella {
 
 #undef VALUE
 #define VALUE(_field, _suffix) \
-  _field(NIL, ::std::monostate)_suffix \
+  _field(NIL, ::std::nullptr_t)_suffix \
   _field(BOOL, bool)_suffix    \
   _field(INTEGER, LUA_INTEGER)_suffix  \
   _field(NUMBER, LUA_NUMBER)_suffix    \
-  _field(STRING, ::std::shared_ptr<::std::string>)_suffix \
-  _field(TABLE, ::std::shared_ptr<::std::vector<Member>>) \
+  _field(STRING, ::std::string_view)_suffix \
+  _field(TABLE, Table *)_suffix \
+  _field(ARRAY, Array *) \
   //
 
+class Value;
 struct Member;
 
+/**
+ * @brief a string key with its hash computed once, a symbol from Document::Intern points at the bytes
+ * shared by the interned keys of the document, so a lookup matches them by pointer
+ */
+class Symbol {
+ private:
+  ::std::string_view str_;
+  ::std::uint32_t hash_;
+
+ public:
+  explicit Symbol(::std::string_view str);
+
+  [[nodiscard]] ::std::string_view str() const { return str_; }
+  [[nodiscard]] ::std::uint32_t hash() const { return hash_; }
+};
+
+using Array = ::std::vector<Value, StdAllocator<Value>>;
+
+/**
+ * @brief packed sequences, a value adopts the buffer as it is, e.g. one filled by State::GetNumbers
+ */
+using Numbers = ::std::vector<LUA_NUMBER>;
+using Integers = ::std::vector<LUA_INTEGER>;
+
+/**
+ * @brief members in insertion order, tables above kIndexThreshold members also keep
+ * an open addressing index over the keys, so lookups stay O(1) as the table grows
+ *
+ * a table with a source is lazy, its members are loaded on the first begin(), size() or empty(),
+ * a find() missing the loaded members asks the source for that key alone when it fetches keys,
+ * or loads the whole table otherwise. end() never loads, so take the begin before the end.
+ */
+class Table {
+ public:
+  using Members = ::std::vector<Member, StdAllocator<Member>>;
+  using iterator = Members::iterator;
+  using const_iterator = Members::const_iterator;
+
+  static constexpr ::std::size_t kIndexThreshold = 16;
+
+  class Source {
+   public:
+    virtual ~Source() = default;
+
+    /**
+     * @brief adds the members not loaded yet
+     */
+    virtual void Load(Table &table) = 0;
+
+    /**
+     * @brief adds the member of one key, members already added must stay where they are
+     * @return false when the key is absent
+     */
+    virtual bool Fetch(Table &table, LUA_INTEGER key) = 0;
+    virtual bool Fetch(Table &table, ::std::string_view key) = 0;
+
+    /**
+     * @brief whether find() fetches single keys instead of loading the table
+     */
+    [[nodiscard]] virtual bool FetchesKeys() const = 0;
+  };
+
+ private:
+  struct Slot {
+    ::std::uint32_t hash_;
+    ::std::uint32_t pos_; // member position + 1, 0 marks an empty slot
+  };
+
+  Members members_;
+  ::std::vector<Slot, StdAllocator<Slot>> index_;
+  ::std::unique_ptr<Source> source_;
+
+ public:
+  explicit Table(const StdAllocator<Member> &allocator) : members_(allocator), index_(allocator) {}
+  Table(const StdAllocator<Member> &allocator, ::std::unique_ptr<Source> source)
+      : members_(allocator), index_(allocator), source_(::std::move(source)) {}
+
+  iterator begin() { return Ensure(), members_.begin(); }
+  iterator end() { return members_.end(); }
+  [[nodiscard]] const_iterator begin() const { return Ensure(), members_.begin(); }
+  [[nodiscard]] const_iterator end() const { return members_.end(); }
+  [[nodiscard]] ::std::size_t size() const { return Ensure(), members_.size(); }
+  [[nodiscard]] bool empty() const { return Ensure(), members_.empty(); }
+  Member &back() { return members_.back(); }
+
+  [[nodiscard]] bool lazy() const { return source_ != nullptr; }
+  [[nodiscard]] StdAllocator<Member> get_allocator() const { return members_.get_allocator(); }
+
+  /**
+   * @brief loads the remaining members and drops the source
+   */
+  void load();
+
+  void reserve(::std::size_t size);
+  Member &emplace_back(Value &&key, Value &&value);
+
+  /**
+   * @brief keeps the members whose position satisfies keep(pos), in order, and rebuilds the index
+   * @return the number of members removed
+   */
+  template<typename Keep>
+  ::std::size_t retain(Keep keep);
+
+  iterator find(LUA_INTEGER key);
+  iterator find(::std::string_view key);
+  iterator find(const Symbol &key);
+
+  /**
+   * @brief key hashes, stable across processes since snapshots store indexes built with them
+   */
+  static ::std::uint32_t Hash(LUA_INTEGER key);
+  static ::std::uint32_t Hash(::std::string_view key);
+
+ private:
+  static ::std::uint32_t Hash(const Value &key);
+  static ::std::uint32_t Hash(const Symbol &key) { return key.hash(); }
+  static bool Matches(const Value &member_key, LUA_INTEGER key);
+  static bool Matches(const Value &member_key, ::std::string_view key);
+  static bool Matches(const Value &member_key, const Symbol &key);
+
+  void Ensure() const;
+  template<typename Key>
+  iterator Search(const Key &key);
+  template<typename Key>
+  iterator Fetch(Key key);
+  template<typename Key>
+  iterator Lookup(const Key &key);
+  void Rehash(::std::size_t capacity);
+  void Insert(::std::uint32_t hash, ::std::size_t pos);
+};
+
 enum Type {
 #undef VALUE_NAME
 #define VALUE_NAME(_name, _type) S_##_name
@@ -43,22 +182,23 @@ enum Type {
 #undef VALUE_NAME
 };
 
-using Data = ::std::variant<
-#undef VALUE_TYPE
-#define VALUE_TYPE(_name, _type) _type
-#undef SUFFIX
-#define SUFFIX ,
-    VALUE(VALUE_TYPE, SUFFIX)
-#undef SUFFIX
-#undef VALUE_TYPE
->;
+/**
+ * @brief reference to a string whose bytes outlive the value, it is stored without copying
+ */
+struct StringRef {
+  explicit StringRef(::std::string_view str) : str_(str) {}
+
+  ::std::string_view str_;
+};
 
 class Document;
 
 class Value {
  public:
-  using MemberIterator = ::std::vector<Member>::iterator;
-  using ConstMemberIterator = ::std::vector<Member>::const_iterator;
+  using MemberIterator = Table::iterator;
+  using ConstMemberIterator = Table::const_iterator;
+  using ValueIterator = Array::iterator;
+  using ConstValueIterator = Array::const_iterator;
 
 #undef VALUE_TYPE
 #define VALUE_TYPE(_name, _type) using S_##_name##_TYPE = _type;
@@ -68,34 +208,96 @@ class Value {
  private:
   friend class Document;
 
-  using String = ::std::string;
-  using Table = ::std::vector<Member>;
+  /**
+   * @brief the type and the storage of the payload, strings come in several storages
+   */
+  enum Tag : ::std::uint8_t {
+    kNilTag,
+    kBoolTag,
+    kIntegerTag,
+    kNumberTag,
+    kInlineStringTag,   // the bytes are stored in the value
+    kHeapStringTag,     // owned, from the C runtime
+    kPoolStringTag,     // owned, from a pool, released with the pool
+    kBorrowedStringTag, // the bytes of a lua string
+    kSymbolStringTag,   // the bytes of the symbol table of a document
+    kTableTag,
+    kArrayTag,
+    kNumbersTag,        // packed, read only
+    kIntegersTag,       // packed, read only
+  };
+
+  struct Heap {
+    ::std::uint8_t tag_;
+    ::std::uint32_t size_; // string length
+    union {
+      S_BOOL_TYPE b_;
+      S_INTEGER_TYPE i_;
+      S_NUMBER_TYPE n_;
+      const char *str_;
+      Table *table_;
+      Array *array_;
+      Numbers *numbers_;
+      Integers *integers_;
+    };
+  };
+
+ public:
+  static constexpr ::std::size_t kMaxInlineLength = sizeof(Heap) - 2; // longest string stored in the value
+
+ private:
+  struct Inline {
+    ::std::uint8_t tag_;
+    ::std::uint8_t size_;
+    char str_[kMaxInlineLength];
+  };
+
+  // both views start with the tag, which is read through heap_ whichever view is active
+  union Data {
+    Heap heap_;
+    Inline inline_;
+  };
 
-  Type type_;
-  Data data_;
+  Data data_{};
 
  public:
-  explicit Value(Type type = S_NIL);
-  explicit Value(S_BOOL_TYPE b) : type_(S_BOOL), data_(b) {};
-  explicit Value(S_INTEGER_TYPE i) : type_(S_INTEGER), data_(i) {};
-  explicit Value(S_NUMBER_TYPE n) : type_(S_NUMBER), data_(n) {};
-  explicit Value(const char *s)
-      : type_(S_STRING), data_(::std::in_place_index<S_STRING>, ::std::make_shared<String>(s, s + strlen(s))) {};
-  explicit Value(::std::string_view s)
-      : type_(S_STRING), data_(::std::in_place_index<S_STRING>, ::std::make_shared<String>(s.begin(), s.end())) {};
-  Value(const Value &value) = default;
-  Value(Value &&value) noexcept: type_(value.type_), data_(::std::move(value.data_)) {};
-  ~Value() = default;
-
-  [[nodiscard]] bool IsNil() const { return type_ == S_NIL; }
-  [[nodiscard]] bool IsBool() const { return type_ == S_BOOL; }
-  [[nodiscard]] bool IsInteger() const { return type_ == S_INTEGER; }
-  [[nodiscard]] bool IsNumber() const { return type_ == S_NUMBER; }
-  [[nodiscard]] bool IsString() const { return type_ == S_STRING; }
-  [[nodiscard]] bool IsTable() const { return type_ == S_TABLE; }
+  explicit Value(Type type = S_NIL) : Value(type, nullptr) {};
+  Value(Type type, MemoryPoolAllocator &allocator) : Value(type, &allocator) {};
+  explicit Value(S_BOOL_TYPE b) {
+    data_.heap_.tag_ = kBoolTag;
+    data_.heap_.b_ = b;
+  };
+  explicit Value(S_INTEGER_TYPE i) {
+    data_.heap_.tag_ = kIntegerTag;
+    data_.heap_.i_ = i;
+  };
+  explicit Value(S_NUMBER_TYPE n) {
+    data_.heap_.tag_ = kNumberTag;
+    data_.heap_.n_ = n;
+  };
+  explicit Value(const char *s) : Value(::std::string_view(s)) {};
+  explicit Value(::std::string_view s) { InitString(s, nullptr); };
+  Value(::std::string_view s, MemoryPoolAllocator &allocator) { InitString(s, &allocator); };
+  explicit Value(StringRef s) { InitString(kBorrowedStringTag, s.str_); };
+  explicit Value(Numbers &&numbers);
+  explicit Value(Integers &&integers);
+  Value(const Value &value) : Value(value, nullptr, false) {};
+  Value(Value &&value) noexcept: data_(value.data_) { value.data_ = Data{}; };
+  ~Value() { Release(); };
+
+  [[nodiscard]] bool IsNil() const { return tag() == kNilTag; }
+  [[nodiscard]] bool IsBool() const { return tag() == kBoolTag; }
+  [[nodiscard]] bool IsInteger() const { return tag() == kIntegerTag; }
+  [[nodiscard]] bool IsNumber() const { return tag() == kNumberTag; }
+  [[nodiscard]] bool IsString() const { return tag() >= kInlineStringTag && tag() <= kSymbolStringTag; }
+  [[nodiscard]] bool IsBorrowed() const { return tag() == kBorrowedStringTag; }
+  [[nodiscard]] bool IsTable() const { return tag() == kTableTag; }
+  [[nodiscard]] bool IsArray() const { return tag() == kArrayTag; }
+  [[nodiscard]] bool IsNumbers() const { return tag() == kNumbersTag; }
+  [[nodiscard]] bool IsIntegers() const { return tag() == kIntegersTag; }
 
   [[nodiscard]] ::std::size_t GetSize() const;
-  [[nodiscard]] Type GetType() const { return type_; };
+  [[nodiscard]] Type GetType() const;
 
   [[nodiscard]] S_BOOL_TYPE GetBool() const;
   [[nodiscard]] S_INTEGER_TYPE GetInteger() const;
@@ -103,22 +305,55 @@ class Value {
   [[nodiscard]] ::std::string_view GetStringView() const;
   [[nodiscard]] ::std::string GetString() const;
   [[nodiscard]] const auto &GetTable() const;
+  [[nodiscard]] const auto &GetArray() const;
+  [[nodiscard]] const Numbers &GetNumbers() const;
+  [[nodiscard]] const Integers &GetIntegers() const;
 
   Value &SetBool(S_BOOL_TYPE b);
   Value &SetInteger(S_INTEGER_TYPE i);
   Value &SetNumber(S_NUMBER_TYPE n);
   Value &SetString(::std::string_view s);
+  Value &SetString(::std::string_view s, MemoryPoolAllocator &allocator);
   Value &SetTable();
-
+  Value &SetTable(MemoryPoolAllocator &allocator);
+  Value &SetArray();
+  Value &SetArray(MemoryPoolAllocator &allocator);
+  Value &SetNumbers(Numbers &&numbers);
+  Value &SetIntegers(Integers &&integers);
+
+  /**
+   * @brief a packed sequence is a S_ARRAY read through GetNumbers or GetIntegers, the non-const accessors
+   * of the elements unpack it into a plain array on first use, the const operator[] reads an element
+   * into a slot of the calling thread, valid until its next packed read. Other values are left as they are
+   */
+  Value &Unpack();
+  Value &Unpack(MemoryPoolAllocator &allocator);
+
+  /**
+   * @brief members of a table, a lua sequence is a S_ARRAY and is read through operator[](size_t) or
+   * ArrayBegin / ArrayEnd, the member accessors of any other type see an empty table
+   */
   MemberIterator MemberBegin();
   MemberIterator MemberEnd();
   MemberIterator FindMember(::std::size_t key);
   MemberIterator FindMember(::std::string_view key);
+  MemberIterator FindMember(const Symbol &key);
 
   [[nodiscard]] ConstMemberIterator MemberBegin() const;
   [[nodiscard]] ConstMemberIterator MemberEnd() const;
   [[nodiscard]] ConstMemberIterator FindMember(::std::size_t key) const;
   [[nodiscard]] ConstMemberIterator FindMember(::std::string_view key) const;
+  [[nodiscard]] ConstMemberIterator FindMember(const Symbol &key) const;
+
+  /**
+   * @brief elements of an array, the element accessors of any other type see an empty array
+   */
+  ValueIterator ArrayBegin();
+  ValueIterator ArrayEnd();
+  [[nodiscard]] ConstValueIterator ArrayBegin() const;
+  [[nodiscard]] ConstValueIterator ArrayEnd() const;
+  Value &Reserve(::std::size_t capacity);
+  Value &PushBack(Value &&value);
 
   Value &operator=(const Value &val);
   Value &operator=(Value &&val) noexcept;
@@ -126,6 +361,8 @@ class Value {
   const Value &operator[](::std::size_t key) const;
   Value &operator[](::std::string_view key);
   const Value &operator[](::std::string_view key) const;
+  Value &operator[](const Symbol &key);
+  const Value &operator[](const Symbol &key) const;
 
   template<typename T>
   Value &AddMember(::std::size_t key, T &&value);
@@ -135,6 +372,74 @@ class Value {
 
   template<typename Handler>
   bool WriteTo(Handler &handler) const;
+
+  /**
+   * @brief O(1) copy sharing the tables and arrays of this value, unlike the copy constructor.
+   *
+   * a shared table or array is never written in place, the first write through a non-const accessor
+   * of either version copies that node alone and shares its children, so an update copies only the
+   * nodes from the root down to the change. The copies come from the C runtime and are released with
+   * the last version holding them. Long strings are copied unless they live in a pool,
+   * which must then outlive every version, and a lazy table must be loaded before its versions are
+   * read from several threads.
+   */
+  [[nodiscard]] Value Share() const { return Value(*this, nullptr, true); }
+
+  /**
+   * @brief a lazy table, loaded by the source on first access
+   */
+  static Value LazyTable(::std::unique_ptr<Table::Source> source, MemoryPoolAllocator &allocator);
+
+ private:
+  Value(Type type, MemoryPoolAllocator *allocator);
+
+  /**
+   * @brief copies the strings that do not fit in the value into allocator, and the tables and arrays
+   * deeply or, when sharing, by reference
+   */
+  Value(const Value &value, MemoryPoolAllocator *allocator, bool share);
+
+  /**
+   * @brief gives this value a private copy of its table or array when another version shares it
+   */
+  void Detach();
+
+  /**
+   * @brief a string viewing the bytes of a symbol table, which outlive the value
+   */
+  static Value SymbolString(::std::string_view s);
+
+  [[nodiscard]] Tag tag() const { return static_cast<Tag>(data_.heap_.tag_); }
+
+  /**
+   * @brief the table or the array of the value, an empty one shared by every value of another type,
+   * so a mismatch reads as no members or no elements
+   */
+  Table &Members();
+  [[nodiscard]] const Table &Members() const;
+  Array &Elements();
+  [[nodiscard]] const Array &Elements() const;
+
+  void InitString(::std::string_view s, MemoryPoolAllocator *allocator);
+  void InitString(Tag tag, ::std::string_view s);
+  void Release() noexcept;
+
+  // reference count stored in front of every table and array
+  struct alignas(::std::max_align_t) Shared {
+    ::std::atomic<::std::uint32_t> refs_;
+  };
+
+  template<typename T, typename... Args>
+  static T *Make(MemoryPoolAllocator *allocator, Args &&...args);
+  template<typename T>
+  static constexpr ::std::size_t kBlocks = 1 + (sizeof(T) + sizeof(Shared) - 1) / sizeof(Shared);
+  template<typename T>
+  static Shared *Header(T *ptr) { return reinterpret_cast<Shared *>(ptr) - 1; }
+  template<typename T>
+  static void Unref(T *ptr) noexcept;
+  static Table *Clone(const Table &source, MemoryPoolAllocator *pool, bool share);
+  static Array *Clone(const Array &source, MemoryPoolAllocator *pool, bool share);
+  Value &Unpack(MemoryPoolAllocator *allocator);
 };
 
 #undef VALUE
@@ -147,65 +452,388 @@ struct Member {
   Value value_;
 };
 
-inline Value::Value(Type type) : type_(type), data_() {
+static_assert(sizeof(Value) == 16, "value layout");
+static_assert(sizeof(Member) == 32, "member layout");
+
+inline void Table::reserve(::std::size_t size) {
+  members_.reserve(size);
+  if (size >= kIndexThreshold && index_.size() < size * 2) { Rehash(size * 2); }
+}
+
+inline Member &Table::emplace_back(Value &&key, Value &&value) {
+  auto &member = members_.emplace_back(::std::move(key), ::std::move(value));
+  if (!index_.empty()) {
+    if (members_.size() * 2 > index_.size()) { Rehash(index_.size() * 2); }
+    else { Insert(Hash(member.key_), members_.size() - 1); }
+  } else if (members_.size() >= kIndexThreshold) {
+    Rehash(members_.size() * 2);
+  }
+  return member;
+}
+
+template<typename Keep>
+inline ::std::size_t Table::retain(Keep keep) {
+  ::std::size_t kept = 0;
+  for (::std::size_t pos = 0; pos < members_.size(); ++pos) {
+    if (!keep(pos)) { continue; }
+    if (kept != pos) { members_[kept] = ::std::move(members_[pos]); }
+    ++kept;
+  }
+  auto removed = members_.size() - kept;
+  if (removed != 0) {
+    members_.erase(members_.begin() + static_cast<Members::difference_type>(kept), members_.end());
+    if (!index_.empty()) { Rehash(index_.size()); }
+  }
+  return removed;
+}
+
+inline void Table::load() {
+  // the source is dropped first, the members it adds must not load again
+  auto source = ::std::move(source_);
+  source->Load(*this);
+}
+
+inline Table::iterator Table::find(LUA_INTEGER key) {
+  auto it = Search(key);
+  if (it != members_.end() || source_ == nullptr) { return it; }
+  return Fetch(key);
+}
+
+inline Table::iterator Table::find(::std::string_view key) {
+  auto it = Search(key);
+  if (it != members_.end() || source_ == nullptr) { return it; }
+  return Fetch(key);
+}
+
+inline Table::iterator Table::find(const Symbol &key) {
+  auto it = Search(key);
+  if (it != members_.end() || source_ == nullptr) { return it; }
+  return Fetch(key.str());
+}
+
+/**
+ * @brief lazy tables are never const objects, they live behind the pointer of their value
+ */
+inline void Table::Ensure() const {
+  if (source_ != nullptr) { const_cast<Table *>(this)->load(); }
+}
+
+template<typename Key>
+inline Table::iterator Table::Search(const Key &key) {
+  if (!index_.empty()) { return Lookup(key); }
+  return ::std::find_if(members_.begin(), members_.end(), [&key](const Member &member) -> bool {
+    return Matches(member.key_, key);
+  });
+}
+
+template<typename Key>
+inline Table::iterator Table::Fetch(Key key) {
+  if (!source_->FetchesKeys()) {
+    load();
+    return Search(key);
+  }
+  return source_->Fetch(*this, key) ? members_.end() - 1 : members_.end();
+}
+
+inline ::std::uint32_t Table::Hash(LUA_INTEGER key) {
+  // murmur3 finalizer
+  auto h = static_cast<::std::uint64_t>(key);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return static_cast<::std::uint32_t>(h);
+}
+
+inline ::std::uint32_t Table::Hash(::std::string_view key) {
+  // 32-bit FNV-1a
+  ::std::uint32_t h = 2166136261u;
+  for (auto c : key) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+inline ::std::uint32_t Table::Hash(const Value &key) {
+  return key.IsInteger() ? Hash(key.GetInteger()) : Hash(key.GetStringView());
+}
+
+inline bool Table::Matches(const Value &member_key, LUA_INTEGER key) {
+  return member_key.IsInteger() && member_key.GetInteger() == key;
+}
+
+inline bool Table::Matches(const Value &member_key, ::std::string_view key) {
+  return member_key.IsString() && member_key.GetStringView() == key;
+}
+
+inline bool Table::Matches(const Value &member_key, const Symbol &key) {
+  if (!member_key.IsString()) { return false; }
+  auto str = member_key.GetStringView();
+  // interned keys share their bytes, the comparison is left for keys added otherwise
+  return (str.data() == key.str().data() && str.size() == key.str().size()) || str == key.str();
+}
+
+template<typename Key>
+inline Table::iterator Table::Lookup(const Key &key) {
+  auto hash = Hash(key);
+  auto mask = index_.size() - 1;
+  for (auto i = hash & mask;; i = (i + 1) & mask) {
+    const auto &slot = index_[i];
+    if (slot.pos_ == 0) { return members_.end(); }
+    if (slot.hash_ == hash && Matches(members_[slot.pos_ - 1].key_, key)) {
+      return members_.begin() + static_cast<Members::difference_type>(slot.pos_ - 1);
+    }
+  }
+}
+
+inline Symbol::Symbol(::std::string_view str) : str_(str), hash_(Table::Hash(str)) {}
+
+inline void Table::Rehash(::std::size_t capacity) {
+  ::std::size_t size = kIndexThreshold;
+  while (size < capacity) { size <<= 1; }
+  index_.assign(size, Slot{0, 0});
+  for (::std::size_t pos = 0; pos < members_.size(); ++pos) {
+    Insert(Hash(members_[pos].key_), pos);
+  }
+}
+
+inline void Table::Insert(::std::uint32_t hash, ::std::size_t pos) {
+  STELLA_ASSERT(pos < UINT32_MAX);
+  auto mask = index_.size() - 1;
+  auto i = hash & mask;
+  while (index_[i].pos_ != 0) { i = (i + 1) & mask; }
+  index_[i] = Slot{hash, static_cast<::std::uint32_t>(pos + 1)};
+}
+
+inline Value::Value(Type type, MemoryPoolAllocator *allocator) {
   switch (type) {
-    case S_NIL:
-    case S_BOOL:
-    case S_INTEGER:
-    case S_NUMBER: break;
-    case S_STRING:data_.emplace<S_STRING>(::std::make_shared<String>());
+    case S_NIL: break;
+    case S_BOOL: data_.heap_.tag_ = kBoolTag;
+      break;
+    case S_INTEGER: data_.heap_.tag_ = kIntegerTag;
+      break;
+    case S_NUMBER: data_.heap_.tag_ = kNumberTag;
+      break;
+    case S_STRING: InitString({}, allocator);
       break;
-    case S_TABLE: data_ = ::std::make_shared<Table>();
+    case S_TABLE: data_.heap_.table_ = Make<Table>(allocator, StdAllocator<Member>(allocator));
+      data_.heap_.tag_ = kTableTag;
+      break;
+    case S_ARRAY: data_.heap_.array_ = Make<Array>(allocator, StdAllocator<Value>(allocator));
+      data_.heap_.tag_ = kArrayTag;
       break;
     default: STELLA_ASSERT(false && "bad type");
   }
 }
 
+inline Value::Value(const Value &value, MemoryPoolAllocator *allocator, bool share) : data_(value.data_) {
+  switch (value.tag()) {
+    case kHeapStringTag: InitString(value.GetStringView(), allocator);
+      break;
+    case kPoolStringTag:
+      // the bytes of a pool are never released one by one
+      if (!share) { InitString(value.GetStringView(), allocator); }
+      break;
+    case kTableTag:
+      if (share) { Header(data_.heap_.table_)->refs_.fetch_add(1, ::std::memory_order_relaxed); }
+      else {
+        const auto &source = *value.data_.heap_.table_;
+        data_.heap_.table_ = Clone(source, source.get_allocator().pool(), false);
+      }
+      break;
+    case kArrayTag:
+      if (share) { Header(data_.heap_.array_)->refs_.fetch_add(1, ::std::memory_order_relaxed); }
+      else {
+        const auto &source = *value.data_.heap_.array_;
+        data_.heap_.array_ = Clone(source, source.get_allocator().pool(), false);
+      }
+      break;
+    case kNumbersTag:
+      if (share) { Header(data_.heap_.numbers_)->refs_.fetch_add(1, ::std::memory_order_relaxed); }
+      else { data_.heap_.numbers_ = Make<Numbers>(nullptr, *value.data_.heap_.numbers_); }
+      break;
+    case kIntegersTag:
+      if (share) { Header(data_.heap_.integers_)->refs_.fetch_add(1, ::std::memory_order_relaxed); }
+      else { data_.heap_.integers_ = Make<Integers>(nullptr, *value.data_.heap_.integers_); }
+      break;
+    default: break;
+  }
+}
+
+/**
+ * @brief a copy of the node drawn from pool, or the C runtime when it is nullptr, its children
+ * copied deeply or shared
+ */
+inline Table *Value::Clone(const Table &source, MemoryPoolAllocator *pool, bool share) {
+  // a lazy table is loaded by size() and copied as a plain one
+  auto *table = Make<Table>(pool, StdAllocator<Member>(pool));
+  table->reserve(source.size());
+  for (const auto &member : source) {
+    table->emplace_back(Value(member.key_, pool, share), Value(member.value_, pool, share));
+  }
+  return table;
+}
+
+inline Array *Value::Clone(const Array &source, MemoryPoolAllocator *pool, bool share) {
+  auto *array = Make<Array>(pool, StdAllocator<Value>(pool));
+  array->reserve(source.size());
+  for (const auto &element : source) { array->emplace_back(Value(element, pool, share)); }
+  return array;
+}
+
+inline void Value::Detach() {
+  // the private copy comes from the C runtime, it is released with the last version holding it
+  // where a pool would keep it until the pool dies
+  if (IsTable() && Header(data_.heap_.table_)->refs_.load(::std::memory_order_acquire) != 1) {
+    auto *table = Clone(*data_.heap_.table_, nullptr, true);
+    Unref(data_.heap_.table_);
+    data_.heap_.table_ = table;
+  } else if (IsArray() && Header(data_.heap_.array_)->refs_.load(::std::memory_order_acquire) != 1) {
+    auto *array = Clone(*data_.heap_.array_, nullptr, true);
+    Unref(data_.heap_.array_);
+    data_.heap_.array_ = array;
+  }
+}
+
+inline Value Value::SymbolString(::std::string_view s) {
+  Value value;
+  if (s.size() <= kMaxInlineLength) { value.InitString(s, nullptr); }
+  else { value.InitString(kSymbolStringTag, s); }
+  return value;
+}
+
+inline void Value::InitString(::std::string_view s, MemoryPoolAllocator *allocator) {
+  if (s.size() <= kMaxInlineLength) {
+    data_.inline_ = Inline{kInlineStringTag, static_cast<::std::uint8_t>(s.size()), {}};
+    if (!s.empty()) { ::std::memcpy(data_.inline_.str_, s.data(), s.size()); }
+    return;
+  }
+  auto *str = static_cast<char *>(allocator != nullptr ? allocator->Malloc(s.size()) : CrtAllocator().Malloc(s.size()));
+  if (str == nullptr) { throw ::std::bad_alloc(); }
+  ::std::memcpy(str, s.data(), s.size());
+  InitString(allocator != nullptr ? kPoolStringTag : kHeapStringTag, {str, s.size()});
+}
+
+inline void Value::InitString(Tag tag, ::std::string_view s) {
+  // lengths are kept in 32 bits to fit the value in 16 bytes
+  STELLA_ASSERT(s.size() <= UINT32_MAX);
+  data_.heap_.tag_ = tag;
+  data_.heap_.size_ = static_cast<::std::uint32_t>(s.size());
+  data_.heap_.str_ = s.data();
+}
+
+inline void Value::Release() noexcept {
+  switch (tag()) {
+    case kHeapStringTag: CrtAllocator::Free(const_cast<char *>(data_.heap_.str_));
+      break;
+    case kTableTag: Unref(data_.heap_.table_);
+      break;
+    case kArrayTag: Unref(data_.heap_.array_);
+      break;
+    case kNumbersTag: Unref(data_.heap_.numbers_);
+      break;
+    case kIntegersTag: Unref(data_.heap_.integers_);
+      break;
+    default: break;
+  }
+  data_ = Data{};
+}
+
+template<typename T, typename... Args>
+inline T *Value::Make(MemoryPoolAllocator *allocator, Args &&...args) {
+  auto *header = new(StdAllocator<Shared>(allocator).allocate(kBlocks<T>)) Shared{1};
+  return new(header + 1) T(::std::forward<Args>(args)...);
+}
+
+template<typename T>
+inline void Value::Unref(T *ptr) noexcept {
+  auto *header = Header(ptr);
+  if (header->refs_.fetch_sub(1, ::std::memory_order_acq_rel) != 1) { return; }
+  // packed sequences come from the C runtime, whatever the pool of the value
+  StdAllocator<Shared> allocator;
+  if constexpr (!::std::is_same_v<T, Numbers> && !::std::is_same_v<T, Integers>) {
+    allocator = StdAllocator<Shared>(ptr->get_allocator());
+  }
+  ptr->~T();
+  header->~Shared();
+  allocator.deallocate(header, kBlocks<T>);
+}
+
+inline Value::Value(Numbers &&numbers) {
+  data_.heap_.numbers_ = Make<Numbers>(nullptr, ::std::move(numbers));
+  data_.heap_.tag_ = kNumbersTag;
+}
+
+inline Value::Value(Integers &&integers) {
+  data_.heap_.integers_ = Make<Integers>(nullptr, ::std::move(integers));
+  data_.heap_.tag_ = kIntegersTag;
+}
+
+inline Value Value::LazyTable(::std::unique_ptr<Table::Source> source, MemoryPoolAllocator &allocator) {
+  Value value;
+  value.data_.heap_.table_ = Make<Table>(&allocator, StdAllocator<Member>(&allocator), ::std::move(source));
+  value.data_.heap_.tag_ = kTableTag;
+  return value;
+}
+
+inline Type Value::GetType() const {
+  static constexpr Type kTypes[] = {S_NIL, S_BOOL, S_INTEGER, S_NUMBER, S_STRING, S_STRING, S_STRING, S_STRING,
+                                    S_STRING, S_TABLE, S_ARRAY, S_ARRAY, S_ARRAY};
+  return kTypes[tag()];
+}
+
 inline ::std::size_t Value::GetSize() const {
-  switch (type_) {
-    case S_TABLE: return ::std::get<S_TABLE>(data_)->size();
+  switch (GetType()) {
+    case S_TABLE: return data_.heap_.table_->size();
+    case S_ARRAY:
+      if (IsNumbers()) { return data_.heap_.numbers_->size(); }
+      if (IsIntegers()) { return data_.heap_.integers_->size(); }
+      return data_.heap_.array_->size();
     default: return 1;
   }
 }
 
 inline Value::S_BOOL_TYPE Value::GetBool() const {
-  STELLA_ASSERT(type_ == S_BOOL);
-  return ::std::get<S_BOOL>(data_);
+  STELLA_ASSERT(IsBool());
+  return data_.heap_.b_;
 }
 
 inline Value::S_INTEGER_TYPE Value::GetInteger() const {
-  STELLA_ASSERT(type_ == S_BOOL || type_ == S_INTEGER || type_ == S_NUMBER);
-  switch (type_) {
-    case S_BOOL:return ::std::get<S_BOOL>(data_);
-    case S_INTEGER:return ::std::get<S_INTEGER>(data_);
-    case S_NUMBER:return static_cast<S_INTEGER_TYPE>(::std::get<S_NUMBER>(data_));
+  STELLA_ASSERT(IsBool() || IsInteger() || IsNumber());
+  switch (GetType()) {
+    case S_BOOL:return data_.heap_.b_;
+    case S_INTEGER:return data_.heap_.i_;
+    case S_NUMBER:return static_cast<S_INTEGER_TYPE>(data_.heap_.n_);
     default: STELLA_ASSERT(false);
   }
   return {};
 }
 
 inline Value::S_NUMBER_TYPE Value::GetNumber() const {
-  STELLA_ASSERT(type_ == S_BOOL || type_ == S_INTEGER || type_ == S_NUMBER);
-  switch (type_) {
-    case S_BOOL:return ::std::get<S_BOOL>(data_);
-    case S_INTEGER:return static_cast<S_NUMBER_TYPE>(::std::get<S_INTEGER>(data_));
-    case S_NUMBER:return ::std::get<S_NUMBER>(data_);
+  STELLA_ASSERT(IsBool() || IsInteger() || IsNumber());
+  switch (GetType()) {
+    case S_BOOL:return data_.heap_.b_;
+    case S_INTEGER:return static_cast<S_NUMBER_TYPE>(data_.heap_.i_);
+    case S_NUMBER:return data_.heap_.n_;
     default: STELLA_ASSERT(false);
   }
   return {};
 }
 
 inline ::std::string_view Value::GetStringView() const {
-  STELLA_ASSERT(type_ == S_STRING);
-  return *::std::get<S_STRING>(data_);
+  STELLA_ASSERT(IsString());
+  if (tag() == kInlineStringTag) { return {data_.inline_.str_, data_.inline_.size_}; }
+  return {data_.heap_.str_, data_.heap_.size_};
 }
 
 inline ::std::string Value::GetString() const {
-  STELLA_ASSERT(type_ == S_BOOL || type_ == S_INTEGER || type_ == S_NUMBER || type_ == S_STRING);
-  switch (type_) {
-    case S_BOOL:return ::std::get<S_BOOL>(data_) ? "true" : "false";
-    case S_INTEGER:return ::std::to_string(::std::get<S_INTEGER>(data_));
-    case S_NUMBER:return ::std::to_string(::std::get<S_NUMBER>(data_));
+  STELLA_ASSERT(IsBool() || IsInteger() || IsNumber() || IsString());
+  switch (GetType()) {
+    case S_BOOL:return data_.heap_.b_ ? "true" : "false";
+    case S_INTEGER:return ::std::to_string(data_.heap_.i_);
+    case S_NUMBER:return ::std::to_string(data_.heap_.n_);
     case S_STRING:return ::std::string(GetStringView());
     default: STELLA_ASSERT(false);
   }
@@ -213,8 +841,23 @@ inline ::std::string Value::GetString() const {
 }
 
 inline const auto &Value::GetTable() const {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return ::std::get<S_TABLE>(data_);
+  STELLA_ASSERT(IsTable());
+  return data_.heap_.table_;
+}
+
+inline const auto &Value::GetArray() const {
+  STELLA_ASSERT(IsArray());
+  return data_.heap_.array_;
+}
+
+inline const Numbers &Value::GetNumbers() const {
+  STELLA_ASSERT(IsNumbers());
+  return *data_.heap_.numbers_;
+}
+
+inline const Integers &Value::GetIntegers() const {
+  STELLA_ASSERT(IsIntegers());
+  return *data_.heap_.integers_;
 }
 
 inline Value &Value::SetBool(S_BOOL_TYPE b) {
@@ -237,95 +880,224 @@ inline Value &Value::SetString(::std::string_view s) {
   return *new(this) Value(s);
 }
 
+inline Value &Value::SetString(::std::string_view s, MemoryPoolAllocator &allocator) {
+  this->~Value();
+  return *new(this) Value(s, allocator);
+}
+
 inline Value &Value::SetTable() {
   this->~Value();
   return *new(this) Value(S_TABLE);
 }
 
+inline Value &Value::SetTable(MemoryPoolAllocator &allocator) {
+  this->~Value();
+  return *new(this) Value(S_TABLE, allocator);
+}
+
+inline Value &Value::SetArray() {
+  this->~Value();
+  return *new(this) Value(S_ARRAY);
+}
+
+inline Value &Value::SetArray(MemoryPoolAllocator &allocator) {
+  this->~Value();
+  return *new(this) Value(S_ARRAY, allocator);
+}
+
+inline Value &Value::SetNumbers(Numbers &&numbers) {
+  this->~Value();
+  return *new(this) Value(::std::move(numbers));
+}
+
+inline Value &Value::SetIntegers(Integers &&integers) {
+  this->~Value();
+  return *new(this) Value(::std::move(integers));
+}
+
+inline Value &Value::Unpack() {
+  return Unpack(nullptr);
+}
+
+inline Value &Value::Unpack(MemoryPoolAllocator &allocator) {
+  return Unpack(&allocator);
+}
+
+inline Value &Value::Unpack(MemoryPoolAllocator *allocator) {
+  if (!IsNumbers() && !IsIntegers()) { return *this; }
+  Value array(S_ARRAY, allocator);
+  auto &elements = *array.data_.heap_.array_;
+  if (IsNumbers()) {
+    elements.reserve(GetNumbers().size());
+    for (auto n : GetNumbers()) { elements.emplace_back(n); }
+  } else {
+    elements.reserve(GetIntegers().size());
+    for (auto i : GetIntegers()) { elements.emplace_back(i); }
+  }
+  return *this = ::std::move(array);
+}
+
+inline Table &Value::Members() {
+  STELLA_ASSERT(IsTable());
+  if (!IsTable()) { return const_cast<Table &>(::std::as_const(*this).Members()); }
+  Detach();
+  return *data_.heap_.table_;
+}
+
+inline const Table &Value::Members() const {
+  STELLA_ASSERT(IsTable());
+  if (IsTable()) { return *data_.heap_.table_; }
+  // never written, a lookup in it finds nothing without a source to fetch from
+  static Table empty{StdAllocator<Member>()};
+  return empty;
+}
+
+inline Array &Value::Elements() {
+  STELLA_ASSERT(GetType() == S_ARRAY);
+  Unpack();
+  if (!IsArray()) { return const_cast<Array &>(::std::as_const(*this).Elements()); }
+  Detach();
+  return *data_.heap_.array_;
+}
+
+inline const Array &Value::Elements() const {
+  STELLA_ASSERT(IsArray());
+  if (IsArray()) { return *data_.heap_.array_; }
+  static Array empty{StdAllocator<Value>()};
+  return empty;
+}
+
 inline Value::MemberIterator Value::MemberBegin() {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return ::std::get<S_TABLE>(data_)->begin();
+  return Members().begin();
 }
 
 inline Value::MemberIterator Value::MemberEnd() {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return ::std::get<S_TABLE>(data_)->end();
+  return Members().end();
 }
 
 inline Value::MemberIterator Value::FindMember(::std::size_t key) {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return ::std::find_if(::std::get<S_TABLE>(data_)->begin(),
-                        ::std::get<S_TABLE>(data_)->end(),
-                        [key](const Member &member) -> bool {
-                          return member.key_.IsInteger()
-                              && member.key_.GetInteger() == static_cast<S_INTEGER_TYPE>(key);
-                        });
+  return Members().find(static_cast<S_INTEGER_TYPE>(key));
 }
 
 inline Value::MemberIterator Value::FindMember(::std::string_view key) {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return ::std::find_if(::std::get<S_TABLE>(data_)->begin(),
-                        ::std::get<S_TABLE>(data_)->end(),
-                        [key](const Member &member) -> bool {
-                          return member.key_.IsString() && member.key_.GetStringView() == key;
-                        });
+  return Members().find(key);
 }
 
+inline Value::MemberIterator Value::FindMember(const Symbol &key) {
+  return Members().find(key);
+}
+
+// the const accessors read a shared node in place
+
 inline Value::ConstMemberIterator Value::MemberBegin() const {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return const_cast<Value &>(*this).MemberBegin();
+  return Members().begin();
 }
 
 inline Value::ConstMemberIterator Value::MemberEnd() const {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return const_cast<Value &>(*this).MemberEnd();
+  return Members().end();
 }
 
 inline Value::ConstMemberIterator Value::FindMember(::std::size_t key) const {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return const_cast<Value &>(*this).FindMember(key);
+  return const_cast<Table &>(Members()).find(static_cast<S_INTEGER_TYPE>(key));
 }
 
 inline Value::ConstMemberIterator Value::FindMember(::std::string_view key) const {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return const_cast<Value &>(*this).FindMember(key);
+  return const_cast<Table &>(Members()).find(key);
+}
+
+inline Value::ConstMemberIterator Value::FindMember(const Symbol &key) const {
+  return const_cast<Table &>(Members()).find(key);
+}
+
+inline Value::ValueIterator Value::ArrayBegin() {
+  return Elements().begin();
+}
+
+inline Value::ValueIterator Value::ArrayEnd() {
+  return Elements().end();
+}
+
+inline Value::ConstValueIterator Value::ArrayBegin() const {
+  return Elements().begin();
+}
+
+inline Value::ConstValueIterator Value::ArrayEnd() const {
+  return Elements().end();
+}
+
+inline Value &Value::Reserve(::std::size_t capacity) {
+  STELLA_ASSERT(IsTable() || IsArray());
+  Detach();
+  if (IsTable()) { data_.heap_.table_->reserve(capacity); }
+  else { data_.heap_.array_->reserve(capacity); }
+  return *this;
+}
+
+inline Value &Value::PushBack(Value &&value) {
+  STELLA_ASSERT(IsArray());
+  Detach();
+  return data_.heap_.array_->emplace_back(::std::move(value));
 }
 
 inline Value &Value::operator=(const Value &val) {
   STELLA_ASSERT(this != &val);
-  type_ = val.type_;
-  data_ = val.data_;
-  return *this;
+  return *this = Value(val);
 }
 
 inline Value &Value::operator=(Value &&val) noexcept {
   STELLA_ASSERT(this != &val);
-  type_ = val.type_;
-  data_ = ::std::move(val.data_);
-  val.type_ = S_NIL;
+  // taken before the release, val may live inside this value
+  auto data = val.data_;
+  val.data_ = Data{};
+  Release();
+  data_ = data;
   return *this;
 }
 
 inline Value &Value::operator[](::std::size_t key) {
-  STELLA_ASSERT(type_ == S_TABLE);
+  STELLA_ASSERT(IsTable() || GetType() == S_ARRAY);
+  Unpack();
+  Detach();
+  return const_cast<Value &>(::std::as_const(*this)[key]);
+}
+
+inline const Value &Value::operator[](::std::size_t key) const {
+  STELLA_ASSERT(IsTable() || GetType() == S_ARRAY);
+  static Value fake(S_NIL);
+  if (IsNumbers() || IsIntegers()) {
+    // the elements of a packed sequence are not stored as values
+    thread_local Value element;
+    auto size = GetSize();
+    STELLA_ASSERT(key >= 1 && key <= size && "index out of range");
+    if (key < 1 || key > size) { return fake; }
+    element = IsNumbers() ? Value(GetNumbers()[key - 1]) : Value(GetIntegers()[key - 1]);
+    return element;
+  }
+  if (IsArray()) {
+    // lua sequences are 1-based
+    const auto &array = *data_.heap_.array_;
+    STELLA_ASSERT(key >= 1 && key <= array.size() && "index out of range");
+    if (key >= 1 && key <= array.size()) { return array[key - 1]; }
+    return fake;
+  }
   auto it = FindMember(key);
-  if (it != ::std::get<S_TABLE>(data_)->end()) {
+  if (it != MemberEnd()) {
     return it->value_;
   }
   STELLA_ASSERT(false && "value not found");
-  static Value fake(S_NIL);
   return fake;
 }
 
-inline const Value &Value::operator[](::std::size_t key) const {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return const_cast<Value &>(*this)[key];
+inline Value &Value::operator[](::std::string_view key) {
+  STELLA_ASSERT(IsTable());
+  Detach();
+  return const_cast<Value &>(::std::as_const(*this)[key]);
 }
 
-inline Value &Value::operator[](::std::string_view key) {
-  STELLA_ASSERT(type_ == S_TABLE);
+inline const Value &Value::operator[](::std::string_view key) const {
+  STELLA_ASSERT(IsTable());
   auto it = FindMember(key);
-  if (it != ::std::get<S_TABLE>(data_)->end()) {
+  if (it != MemberEnd()) {
     return it->value_;
   }
   STELLA_ASSERT(false && "value not found");
@@ -333,9 +1105,21 @@ inline Value &Value::operator[](::std::string_view key) {
   return fake;
 }
 
-inline const Value &Value::operator[](::std::string_view key) const {
-  STELLA_ASSERT(type_ == S_TABLE);
-  return const_cast<Value &>(*this)[key];
+inline Value &Value::operator[](const Symbol &key) {
+  STELLA_ASSERT(IsTable());
+  Detach();
+  return const_cast<Value &>(::std::as_const(*this)[key]);
+}
+
+inline const Value &Value::operator[](const Symbol &key) const {
+  STELLA_ASSERT(IsTable());
+  auto it = FindMember(key);
+  if (it != MemberEnd()) {
+    return it->value_;
+  }
+  STELLA_ASSERT(false && "value not found");
+  static Value fake(S_NIL);
+  return fake;
 }
 
 template<typename T>
@@ -349,38 +1133,70 @@ inline Value &Value::AddMember(const char *key, T &&value) {
 }
 
 inline Value &Value::AddMember(Value &&key, Value &&value) {
-  STELLA_ASSERT(type_ == S_TABLE);
-  STELLA_ASSERT(key.type_ == S_INTEGER || key.type_ == S_STRING);
+  STELLA_ASSERT(IsTable());
+  Detach();
+  STELLA_ASSERT(key.IsInteger() || key.IsString());
   STELLA_ASSERT(
-      (key.type_ == S_INTEGER ? FindMember(key.GetInteger()) : FindMember(key.GetStringView())) == MemberEnd()
+      (key.IsInteger() ? FindMember(key.GetInteger()) : FindMember(key.GetStringView())) == MemberEnd()
   );
-  auto ptr = ::std::get<S_TABLE>(data_);
-  ptr->emplace_back(::std::move(key), ::std::move(value));
-  return ptr->back().value_;
+  return data_.heap_.table_->emplace_back(::std::move(key), ::std::move(value)).value_;
 }
 
 #define CALL_HANDLER(expr) do { if (!(expr)) { return false; } } while(false)
 
 template<typename Handler>
 inline bool Value::WriteTo(Handler &handler) const {
-  switch (type_) {
+  switch (GetType()) {
     case S_NIL: CALL_HANDLER(handler.Nil());
       break;
-    case S_BOOL: CALL_HANDLER(handler.Bool());
+    case S_BOOL: CALL_HANDLER(handler.Bool(GetBool()));
       break;
-    case S_INTEGER: CALL_HANDLER(handler.Integer());
+    case S_INTEGER: CALL_HANDLER(handler.Integer(GetInteger()));
       break;
-    case S_NUMBER: CALL_HANDLER(handler.Number());
+    case S_NUMBER: CALL_HANDLER(handler.Number(GetNumber()));
       break;
-    case S_STRING: CALL_HANDLER(handler.String());
+    case S_STRING: CALL_HANDLER(handler.String(GetStringView()));
       break;
-    case S_TABLE: CALL_HANDLER(handler.StartTable());
+    case S_TABLE:
+      if (auto visit = handler::StartTable(handler, 0, GetSize()); visit != handler::Visit::kContinue) {
+        return visit == handler::Visit::kSkip;
+      }
       for (auto &member : *GetTable()) {
-        member.key_.IsInteger() ? handler.Key(member.key_.GetInteger()) : handler.Key(member.key_.GetStringView());
+        CALL_HANDLER(member.key_.IsInteger()
+                         ? handler.Key(member.key_.GetInteger())
+                         : handler.Key(member.key_.GetStringView()));
         CALL_HANDLER(member.value_.WriteTo(handler));
       }
       CALL_HANDLER(handler.EndTable());
       break;
+    case S_ARRAY: {
+      // prefix() comes before each element, the elements of a packed sequence are plain numbers
+      auto elements = [this, &handler](auto &&prefix) -> bool {
+        if (IsNumbers()) {
+          for (auto n : GetNumbers()) { CALL_HANDLER(prefix() && handler.Number(n)); }
+        } else if (IsIntegers()) {
+          for (auto i : GetIntegers()) { CALL_HANDLER(prefix() && handler.Integer(i)); }
+        } else {
+          for (auto &value : *GetArray()) { CALL_HANDLER(prefix() && value.WriteTo(handler)); }
+        }
+        return true;
+      };
+      if constexpr (handler::has_array_v<Handler>) {
+        if (auto visit = handler::StartArray(handler, GetSize()); visit != handler::Visit::kContinue) {
+          return visit == handler::Visit::kSkip;
+        }
+        CALL_HANDLER(elements([] { return true; }));
+        CALL_HANDLER(handler.EndArray());
+      } else {
+        if (auto visit = handler::StartTable(handler, GetSize(), 0); visit != handler::Visit::kContinue) {
+          return visit == handler::Visit::kSkip;
+        }
+        LUA_INTEGER index = 0;
+        CALL_HANDLER(elements([&handler, &index] { return handler.Key(++index); }));
+        CALL_HANDLER(handler.EndTable());
+      }
+      break;
+    }
     default: STELLA_ASSERT(false && "bad type");
   }
   return true;
@@ -0,0 +1,176 @@
+//
+// Created by Homin Su on 2023/6/22.
+//
+
+#ifndef STELLA_INCLUDE_STELLA_WRITE_STREAM_H_
+#define STELLA_INCLUDE_STELLA_WRITE_STREAM_H_
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <charconv>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <utility>
+
+#include "non_copyable.h"
+#include "stella.h"
+
+#include <lua.hpp>
+
+namespace stella {
+
+/**
+ * The stream protocol of the writers:
+ *
+ *   void Put(char c);
+ *   void Puts(::std::string_view str);
+ *   char *Push(::std::size_t n);   // room for n bytes, at most kMaxPush
+ *   void Pop(::std::size_t n);     // gives back the last n bytes of the room left unused
+ *   void Flush();
+ */
+inline constexpr ::std::size_t kMaxPush = 64;
+
+/**
+ * @brief growable in-memory buffer
+ */
+class StringWriteStream : NonCopyable {
+ private:
+  char *begin_ = nullptr;
+  char *end_ = nullptr;
+  char *cap_ = nullptr;
+
+ public:
+  StringWriteStream() = default;
+  explicit StringWriteStream(::std::size_t capacity) { Reserve(capacity); }
+  ~StringWriteStream() { ::std::free(begin_); }
+
+  void Put(char c) {
+    if (end_ == cap_) { Grow(1); }
+    *end_++ = c;
+  }
+  void Puts(::std::string_view str) {
+    if (static_cast<::std::size_t>(cap_ - end_) < str.size()) { Grow(str.size()); }
+    if (!str.empty()) { ::std::memcpy(end_, str.data(), str.size()); }
+    end_ += str.size();
+  }
+  char *Push(::std::size_t n) {
+    if (static_cast<::std::size_t>(cap_ - end_) < n) { Grow(n); }
+    auto *ptr = end_;
+    end_ += n;
+    return ptr;
+  }
+  void Pop(::std::size_t n) { end_ -= n; }
+  void Flush() {}
+
+  void Reserve(::std::size_t capacity) {
+    if (static_cast<::std::size_t>(cap_ - begin_) < capacity) { Grow(capacity - GetSize()); }
+  }
+  void Clear() { end_ = begin_; }
+
+  [[nodiscard]] ::std::size_t GetSize() const { return static_cast<::std::size_t>(end_ - begin_); }
+  [[nodiscard]] ::std::string_view GetStringView() const { return {begin_, GetSize()}; }
+
+ private:
+  void Grow(::std::size_t n);
+};
+
+inline void StringWriteStream::Grow(::std::size_t n) {
+  auto size = GetSize();
+  auto capacity = static_cast<::std::size_t>(cap_ - begin_);
+  auto new_capacity = ::std::max(capacity + (capacity + 1) / 2, ::std::max(size + n, ::std::size_t{256}));
+  auto *ptr = static_cast<char *>(::std::realloc(begin_, new_capacity));
+  if (ptr == nullptr) { throw ::std::bad_alloc(); }
+  begin_ = ptr;
+  end_ = ptr + size;
+  cap_ = ptr + new_capacity;
+}
+
+/**
+ * @brief buffered output to a FILE, flushed when full, on Flush and on destruction
+ */
+class FileWriteStream : NonCopyable {
+ public:
+  static constexpr ::std::size_t kBufferSize = 64 * 1024;
+
+ private:
+  ::std::FILE *file_;
+  ::std::unique_ptr<char[]> buffer_;
+  char *end_;
+  char *cap_;
+
+ public:
+  explicit FileWriteStream(::std::FILE *file)
+      : file_(file), buffer_(new char[kBufferSize]), end_(buffer_.get()), cap_(buffer_.get() + kBufferSize) {}
+  ~FileWriteStream() { Flush(); }
+
+  void Put(char c) {
+    if (end_ == cap_) { Drain(); }
+    *end_++ = c;
+  }
+  void Puts(::std::string_view str);
+  char *Push(::std::size_t n) {
+    STELLA_ASSERT(n <= kMaxPush);
+    if (static_cast<::std::size_t>(cap_ - end_) < n) { Drain(); }
+    auto *ptr = end_;
+    end_ += n;
+    return ptr;
+  }
+  void Pop(::std::size_t n) { end_ -= n; }
+  void Flush() {
+    Drain();
+    ::std::fflush(file_);
+  }
+
+ private:
+  void Drain() {
+    ::std::fwrite(buffer_.get(), 1, static_cast<::std::size_t>(end_ - buffer_.get()), file_);
+    end_ = buffer_.get();
+  }
+};
+
+inline void FileWriteStream::Puts(::std::string_view str) {
+  if (static_cast<::std::size_t>(cap_ - end_) < str.size()) {
+    Drain();
+    // too large to be worth buffering
+    if (str.size() >= kBufferSize) {
+      ::std::fwrite(str.data(), 1, str.size(), file_);
+      return;
+    }
+  }
+  ::std::memcpy(end_, str.data(), str.size());
+  end_ += str.size();
+}
+
+/**
+ * @brief decimal integer, written straight into the stream
+ */
+template<typename Stream>
+inline void PutInteger(Stream &stream, LUA_INTEGER i) {
+  auto *begin = stream.Push(24);
+  auto *end = ::std::to_chars(begin, begin + 24, i).ptr;
+  stream.Pop(static_cast<::std::size_t>(begin + 24 - end));
+}
+
+/**
+ * @brief shortest text that reads back as the same number, finite numbers only, a number with an
+ * integral value keeps a ".0" so that it does not read back as an integer
+ */
+template<typename Stream>
+inline void PutNumber(Stream &stream, LUA_NUMBER n) {
+  auto *begin = stream.Push(kMaxPush);
+  auto *end = ::std::to_chars(begin, begin + kMaxPush - 2, n).ptr;
+  if (::std::find_if(begin, end, [](char c) { return c == '.' || c == 'e'; }) == end) {
+    *end++ = '.';
+    *end++ = '0';
+  }
+  stream.Pop(static_cast<::std::size_t>(begin + kMaxPush - end));
+}
+
+} // namespace stella
+
+#endif //STELLA_INCLUDE_STELLA_WRITE_STREAM_H_
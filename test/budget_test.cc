@@ -0,0 +1,63 @@
+//
+// Created by Homin Su on 2023/6/27.
+//
+
+#include "test.h"
+
+#include "stella/lua_allocator.h"
+#include "stella/state.h"
+
+namespace {
+
+constexpr char kGrow[] = "local t = {} for i = 1, 1e7 do t[i] = tostring(i) end";
+
+/**
+ * @brief a memory limit needs a LuaAllocator, the default allocator of luaL_newstate has no ud to read
+ */
+void TestMemoryWithoutLuaAllocator() {
+  stella::State state;
+  state.LoadString(kGrow);
+  auto base = state.StackSize() - 1;
+
+  stella::State::Budget budget;
+  budget.memory_ = 1 << 20;
+  STELLA_CHECK(state.Call(budget) == stella::error::BAD_VALUE);
+  STELLA_CHECK(state.StackSize() == base);
+
+  // the state is left usable
+  STELLA_CHECK(state.Load("Width = 800"));
+  STELLA_CHECK(state.Call() == stella::error::OK);
+  state.Destroy();
+}
+
+void TestMemory() {
+  stella::LuaAllocator allocator;
+  stella::State state;
+  STELLA_CHECK(state.Open(stella::LuaAllocator::Alloc, &allocator));
+  STELLA_CHECK(state.Load(kGrow));
+
+  stella::State::Budget budget;
+  budget.memory_ = 1 << 20;
+  STELLA_CHECK(state.Call(budget) == stella::error::OUT_OF_MEMORY);
+  STELLA_CHECK(allocator.Limit() == 0);
+  state.Destroy();
+}
+
+void TestInstructions() {
+  stella::State state;
+  state.LoadString("while true do end");
+
+  stella::State::Budget budget;
+  budget.instructions_ = 100000;
+  STELLA_CHECK(state.Call(budget) == stella::error::INSTRUCTION_LIMIT);
+  state.Destroy();
+}
+
+} // namespace
+
+int main() {
+  TestMemoryWithoutLuaAllocator();
+  TestMemory();
+  TestInstructions();
+  return 0;
+}
@@ -0,0 +1,72 @@
+//
+// Created by Homin Su on 2023/6/27.
+//
+
+#include "test.h"
+
+#include <cstddef>
+
+#include "stella/document.h"
+
+namespace {
+
+constexpr char kScript[] = R"(
+Application = {
+  Name = "stella",
+  Handler = function() end,
+  Window = { Width = 800, Height = 600, [print] = 1 },
+  Plugins = { "json", "bencode", { Name = "trace" } },
+}
+)";
+
+void TestParse(stella::State &state, unsigned flags) {
+  auto base = state.StackSize();
+  stella::Document doc;
+  STELLA_CHECK(doc.Parse(state, "Application", flags) == stella::error::OK);
+  STELLA_CHECK(state.StackSize() == base);
+
+  // the function and the function key are left out instead of failing the conversion
+  STELLA_CHECK(doc["Name"].GetStringView() == "stella");
+  STELLA_CHECK(doc.FindMember("Handler") == doc.MemberEnd());
+  STELLA_CHECK(doc["Window"]["Width"].GetInteger() == 800);
+  STELLA_CHECK(doc["Window"].GetSize() == 2);
+  STELLA_CHECK(state.StackSize() == base);
+
+  // a sequence is a table with the keys 1..n
+  const auto &plugins = doc["Plugins"];
+  STELLA_CHECK(plugins.IsTable() && plugins.GetSize() == 3);
+  STELLA_CHECK(plugins[1].GetStringView() == "json");
+  STELLA_CHECK(plugins[3]["Name"].GetStringView() == "trace");
+  STELLA_CHECK(state.StackSize() == base);
+
+  doc.Materialize();
+  STELLA_CHECK(doc["Plugins"][2].GetStringView() == "bencode");
+  STELLA_CHECK(state.StackSize() == base);
+}
+
+void TestParseState(stella::State &state, unsigned flags) {
+  auto base = state.StackSize();
+  stella::Document doc;
+  // _G holds the standard library and itself, both are skipped or stay pending
+  STELLA_CHECK(doc.ParseState(state, flags) == stella::error::OK);
+  STELLA_CHECK(doc["Application"]["Window"]["Height"].GetInteger() == 600);
+  STELLA_CHECK(doc.FindMember("print") == doc.MemberEnd());
+  STELLA_CHECK(state.StackSize() == base);
+}
+
+} // namespace
+
+int main() {
+  stella::State state;
+  state.LoadString(kScript);
+  STELLA_CHECK(state.Call() == stella::error::OK);
+
+  for (unsigned flags : {0u, static_cast<unsigned>(stella::kParseLazyKeysFlag),
+                         static_cast<unsigned>(stella::kParseBorrowStringsFlag)}) {
+    TestParse(state, stella::kParseLazyFlag | flags);
+    TestParseState(state, stella::kParseLazyFlag | flags);
+  }
+
+  state.Destroy();
+  return 0;
+}
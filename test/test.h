@@ -0,0 +1,23 @@
+//
+// Created by Homin Su on 2023/6/27.
+//
+
+#ifndef STELLA_TEST_TEST_H_
+#define STELLA_TEST_TEST_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * Every test is a single translation unit including this header, main returns 0 when every check
+ * passed and the first failing check aborts the test with its expression and location.
+ */
+#define STELLA_CHECK(cond)                                                          \
+  do {                                                                              \
+    if (!(cond)) {                                                                  \
+      ::std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      ::std::exit(EXIT_FAILURE);                                                    \
+    }                                                                               \
+  } while (0)
+
+#endif //STELLA_TEST_TEST_H_